@@ -0,0 +1,146 @@
+--
+-- Benchmark of the helper functions implemented in C++ against equivalent
+-- Lua code. This is a config file which runs the benchmarks when it is
+-- loaded and doesn't process any objects. Run it like this:
+--
+-- osm-tags-transform -c bench/lua-helpers.lua -u drop -f opl test/input-source.opl
+--
+
+local iterations = 1000000
+
+local function bench(name, func)
+    local start = os.clock()
+    func()
+    io.stderr:write(string.format('%-28s %7.3fs\n', name, os.clock() - start))
+end
+
+local keys = { 'name', 'name:de', 'name:zh_pinyin', 'highway', 'building',
+               'addr:street', 'addr:housenumber', 'source', 'ref', 'surface' }
+
+local tags = {}
+for _, k in ipairs(keys) do
+    tags[k] = 'value'
+end
+for _, lang in ipairs({ 'en', 'fr', 'it', 'es', 'ru', 'ja', 'ko', 'ar' }) do
+    tags['name:' .. lang] = 'value'
+end
+
+local function lua_has_prefix(str, prefix)
+    if str == nil then
+        return nil
+    end
+    return str:sub(1, prefix:len()) == prefix
+end
+
+local function lua_has_suffix(str, suffix)
+    if str == nil then
+        return nil
+    end
+    return suffix == '' or str:sub(-suffix:len()) == suffix
+end
+
+local function lua_keys_with_prefix(t, prefix)
+    local result = {}
+    for k, _ in pairs(t) do
+        if lua_has_prefix(k, prefix) then
+            result[#result + 1] = k
+        end
+    end
+    return result
+end
+
+local function lua_match_keys(t, pattern)
+    local result = {}
+    for k, _ in pairs(t) do
+        if k:match(pattern) then
+            result[#result + 1] = k
+        end
+    end
+    return result
+end
+
+local function lua_split_list(str)
+    local result = {}
+    for part in str:gmatch('[^;]+') do
+        part = part:match('^%s*(.-)%s*$')
+        if part ~= '' then
+            result[#result + 1] = part
+        end
+    end
+    return result
+end
+
+local n = iterations / #keys
+
+bench('has_prefix (Lua)', function()
+    for _ = 1, n do
+        for _, k in ipairs(keys) do
+            lua_has_prefix(k, 'name:')
+        end
+    end
+end)
+
+bench('has_prefix (C++)', function()
+    local has_prefix = ott.has_prefix
+    for _ = 1, n do
+        for _, k in ipairs(keys) do
+            has_prefix(k, 'name:')
+        end
+    end
+end)
+
+bench('has_suffix (Lua)', function()
+    for _ = 1, n do
+        for _, k in ipairs(keys) do
+            lua_has_suffix(k, ':de')
+        end
+    end
+end)
+
+bench('has_suffix (C++)', function()
+    local has_suffix = ott.has_suffix
+    for _ = 1, n do
+        for _, k in ipairs(keys) do
+            has_suffix(k, ':de')
+        end
+    end
+end)
+
+n = iterations / 20
+
+bench('keys_with_prefix (Lua)', function()
+    for _ = 1, n do
+        lua_keys_with_prefix(tags, 'name:')
+    end
+end)
+
+bench('keys_with_prefix (C++)', function()
+    for _ = 1, n do
+        ott.keys_with_prefix(tags, 'name:')
+    end
+end)
+
+bench('match_keys (Lua)', function()
+    for _ = 1, n do
+        lua_match_keys(tags, '^name:..$')
+    end
+end)
+
+bench('match_keys (C++)', function()
+    for _ = 1, n do
+        ott.match_keys(tags, 'name:??')
+    end
+end)
+
+bench('split_list (Lua)', function()
+    for _ = 1, n do
+        lua_split_list('A1; A2 ;B 7;; C')
+    end
+end)
+
+bench('split_list (C++)', function()
+    for _ = 1, n do
+        ott.split_list('A1; A2 ;B 7;; C')
+    end
+end)
+
@@ -0,0 +1,79 @@
+#
+#  Runs a performance test.
+#
+#  Runs the command given in the variable 'cmd' which must write its
+#  progress into the file in variable 'progress'. Reads the number of
+#  objects processed, the time needed, and the peak memory use from that
+#  file and compares them to the line for the test 'name' in the file
+#  'baseline'. Fails if the throughput is lower or the memory use is higher
+#  than the baseline by more than 'tolerance' percent.
+#
+
+foreach(_var cmd name progress baseline tolerance)
+    if(NOT DEFINED ${_var})
+        message(FATAL_ERROR "Variable '${_var}' not defined")
+    endif()
+endforeach()
+
+file(REMOVE ${progress})
+
+message("Executing: ${cmd}")
+separate_arguments(cmd)
+
+execute_process(
+    COMMAND ${cmd}
+    RESULT_VARIABLE result
+    ERROR_VARIABLE stderr
+)
+
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Error when calling '${cmd}': ${result}\n${stderr}")
+endif()
+
+file(READ ${progress} json)
+
+function(get_number _json _field _var)
+    if(NOT _json MATCHES "\"${_field}\": ([0-9]+)")
+        message(FATAL_ERROR "Field '${_field}' not found in progress file")
+    endif()
+    set(${_var} ${CMAKE_MATCH_1} PARENT_SCOPE)
+endfunction()
+
+get_number("${json}" nodes nodes)
+get_number("${json}" ways ways)
+get_number("${json}" relations relations)
+get_number("${json}" peak_memory_mb peak_memory)
+
+if(NOT json MATCHES "\"elapsed_seconds\": ([0-9]+)\\.([0-9][0-9][0-9])")
+    message(FATAL_ERROR "Field 'elapsed_seconds' not found in progress file")
+endif()
+string(REGEX REPLACE "^0+([0-9])" "\\1" _millis "${CMAKE_MATCH_2}")
+math(EXPR elapsed_ms "${CMAKE_MATCH_1} * 1000 + ${_millis}")
+if(elapsed_ms EQUAL 0)
+    set(elapsed_ms 1)
+endif()
+
+math(EXPR objects "${nodes} + ${ways} + ${relations}")
+math(EXPR objects_per_second "${objects} * 1000 / ${elapsed_ms}")
+
+message("Processed ${objects} objects in ${elapsed_ms}ms: ${objects_per_second} objects/s, peak memory ${peak_memory}MBytes")
+
+file(STRINGS ${baseline} _lines REGEX "^${name} ")
+if(NOT _lines MATCHES "^${name} ([0-9]+) ([0-9]+)")
+    message(FATAL_ERROR "No baseline for test '${name}' in '${baseline}'")
+endif()
+set(baseline_objects_per_second ${CMAKE_MATCH_1})
+set(baseline_peak_memory ${CMAKE_MATCH_2})
+
+math(EXPR min_objects_per_second "${baseline_objects_per_second} * (100 - ${tolerance}) / 100")
+math(EXPR max_peak_memory "${baseline_peak_memory} * (100 + ${tolerance}) / 100")
+
+if(objects_per_second LESS min_objects_per_second)
+    message(SEND_ERROR "Throughput regression: ${objects_per_second} objects/s is below ${min_objects_per_second} objects/s (baseline ${baseline_objects_per_second})")
+endif()
+
+# Peak memory is not available on all systems.
+if(peak_memory GREATER 0 AND peak_memory GREATER max_peak_memory)
+    message(SEND_ERROR "Memory regression: peak memory ${peak_memory}MBytes is above ${max_peak_memory}MBytes (baseline ${baseline_peak_memory})")
+endif()
+
@@ -8,6 +8,8 @@
 #  If the variable 'cmd2' is set, the command will be run and checked in the
 #  same manner.
 #  Compares output on stdout with reference file in variable 'reference'.
+#  If the variable 'result_file' is set, the file named there is compared with
+#  the reference file instead.
 #
 
 if(NOT cmd)
@@ -73,6 +75,10 @@ if(cmd2)
     endif()
 endif()
 
+if(result_file)
+    set(output ${result_file})
+endif()
+
 set(compare "${CMAKE_COMMAND} -E compare_files ${reference} ${output}")
 message("Executing: ${compare}")
 separate_arguments(compare)
@@ -0,0 +1,144 @@
+#
+#  Test the --resume option.
+#
+#  The directory in variable 'tmpdir' is removed with all its content and
+#  recreated. Then the command in variable 'cmd' is run in directory 'dir'
+#  writing a PBF file into 'tmpdir'. The last few bytes of a copy of this
+#  file are cut off, as if the program had been interrupted while writing
+#  the last block, and the command is run again with --resume on this copy.
+#
+#  Both PBF files are then converted to OPL using the command in variable
+#  'convert' and compared with the reference file in variable 'reference'.
+#
+#  Then checks that resuming fails if the existing output is not a PBF file
+#  and, if the variable 'unsorted_cmd' is set, that this command (which
+#  should read an unsorted input file) fails when resuming.
+#
+
+if(NOT cmd)
+    message(FATAL_ERROR "Variable 'cmd' not defined")
+endif()
+
+if(NOT convert)
+    message(FATAL_ERROR "Variable 'convert' not defined")
+endif()
+
+if(NOT dir)
+    message(FATAL_ERROR "Variable 'dir' not defined")
+endif()
+
+if(NOT tmpdir)
+    message(FATAL_ERROR "Variable 'tmpdir' not defined")
+endif()
+
+if(NOT reference)
+    message(FATAL_ERROR "Variable 'reference' not defined")
+endif()
+
+file(REMOVE_RECURSE ${tmpdir})
+file(MAKE_DIRECTORY ${tmpdir})
+
+set(full ${tmpdir}/full.osm.pbf)
+set(resumed ${tmpdir}/resumed.osm.pbf)
+
+separate_arguments(cmd)
+
+function(run_command _command)
+    string(REPLACE ";" " " _text "${_command}")
+    message("Executing: ${_text}")
+    execute_process(
+        COMMAND ${_command}
+        WORKING_DIRECTORY ${dir}
+        RESULT_VARIABLE _result
+        ERROR_VARIABLE _stderr
+    )
+    if(_result)
+        message(FATAL_ERROR "Error when calling '${_text}': ${_result}\n${_stderr}")
+    endif()
+    set(stderr "${_stderr}" PARENT_SCOPE)
+endfunction()
+
+function(run_failing_command _command _error)
+    string(REPLACE ";" " " _text "${_command}")
+    message("Executing: ${_text}")
+    execute_process(
+        COMMAND ${_command}
+        WORKING_DIRECTORY ${dir}
+        RESULT_VARIABLE _result
+        ERROR_VARIABLE _stderr
+    )
+    if(NOT _result)
+        message(SEND_ERROR "Command '${_text}' should have failed")
+    endif()
+    string(FIND "${_stderr}" "${_error}" _pos)
+    if(_pos EQUAL -1)
+        message(SEND_ERROR "Expected error '${_error}' from '${_text}', got:\n${_stderr}")
+    endif()
+endfunction()
+
+run_command("${cmd};-o;${full}")
+
+# Cut off the end of the last block in the file.
+file(READ ${full} content HEX)
+string(LENGTH "${content}" length)
+math(EXPR size "${length} / 2 - 4")
+message("Executing: head -c ${size} ${full}")
+execute_process(
+    COMMAND head -c ${size} ${full}
+    OUTPUT_FILE ${resumed}
+    RESULT_VARIABLE result
+)
+if(result)
+    message(FATAL_ERROR "Can not truncate '${full}': ${result}")
+endif()
+
+run_command("${cmd};-v;-R;-o;${resumed}")
+
+# Make sure the output of the interrupted run was actually used.
+string(FIND "${stderr}" "Resuming after " pos)
+if(pos EQUAL -1)
+    message(SEND_ERROR "Resumed run did not use the partial output:\n${stderr}")
+endif()
+
+if(EXISTS ${resumed}.partial)
+    message(SEND_ERROR "Partial output '${resumed}.partial' not removed")
+endif()
+
+foreach(name full resumed)
+    set(output ${tmpdir}/${name}.opl)
+    message("Executing: ${convert} ${tmpdir}/${name}.osm.pbf -f opl")
+    set(_convert "${convert} ${tmpdir}/${name}.osm.pbf -f opl")
+    separate_arguments(_convert)
+    execute_process(
+        COMMAND ${_convert}
+        WORKING_DIRECTORY ${dir}
+        RESULT_VARIABLE result
+        OUTPUT_FILE ${output}
+    )
+    if(result)
+        message(FATAL_ERROR "Error when converting '${name}.osm.pbf': ${result}")
+    endif()
+
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -E compare_files ${reference} ${output}
+        RESULT_VARIABLE result
+    )
+    if(result)
+        message(SEND_ERROR "Test output does not match '${reference}'. Output is in '${output}'.")
+    endif()
+endforeach()
+
+# Output which is not a PBF file is an error, it must not be overwritten.
+set(corrupt ${tmpdir}/corrupt.osm.pbf)
+file(WRITE ${corrupt} "This is not a PBF file.\n")
+run_failing_command("${cmd};-R;-o;${corrupt}" "Not a PBF file?")
+if(NOT EXISTS ${corrupt}.partial)
+    message(SEND_ERROR "Output of earlier run '${corrupt}.partial' is gone")
+endif()
+
+if(unsorted_cmd)
+    separate_arguments(unsorted_cmd)
+    run_failing_command("${unsorted_cmd};-R;-o;${tmpdir}/unsorted.osm.pbf"
+                        "Input file must be sorted for --resume")
+endif()
+
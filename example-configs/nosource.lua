@@ -3,8 +3,8 @@
 --
 
 function process(object)
-    object.tags.source = nil
-    return object.tags
+    object:delete_tag('source')
+    return true
 end
 
 ott.process_node = process
@@ -0,0 +1,255 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "change-writer.hpp"
+
+#include <osmium/io/any_compression.hpp>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+static void append_xml_encoded(std::string *out, char const *str)
+{
+    for (; *str != '\0'; ++str) {
+        switch (*str) {
+        case '&':
+            out->append("&amp;");
+            break;
+        case '"':
+            out->append("&quot;");
+            break;
+        case '\'':
+            out->append("&apos;");
+            break;
+        case '<':
+            out->append("&lt;");
+            break;
+        case '>':
+            out->append("&gt;");
+            break;
+        case '\n':
+            out->append("&#xA;");
+            break;
+        case '\r':
+            out->append("&#xD;");
+            break;
+        case '\t':
+            out->append("&#x9;");
+            break;
+        default:
+            out->push_back(*str);
+            break;
+        }
+    }
+}
+
+/// Append coordinate in fixed point format without trailing zeros.
+static void append_coordinate(std::string *out, int32_t value)
+{
+    if (value < 0) {
+        out->push_back('-');
+    }
+    auto const abs_value = static_cast<uint32_t>(std::abs(int64_t{value}));
+    out->append(std::to_string(abs_value / 10000000U));
+
+    auto fraction = abs_value % 10000000U;
+    if (fraction == 0) {
+        return;
+    }
+
+    std::string digits = std::to_string(fraction);
+    digits.insert(0, 7 - digits.size(), '0');
+    digits.erase(digits.find_last_not_of('0') + 1);
+    out->push_back('.');
+    out->append(digits);
+}
+
+/// Open the file (or stdout for an empty name or '-') and return the fd.
+static int open_for_writing(std::string const &filename,
+                            osmium::io::overwrite allow_overwrite)
+{
+    if (filename.empty() || filename == "-") {
+        return STDOUT_FILENO;
+    }
+
+    int const flags = O_WRONLY | O_CREAT |
+                      (allow_overwrite == osmium::io::overwrite::allow
+                           ? O_TRUNC
+                           : O_EXCL);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    int const fd = ::open(filename.c_str(), flags, 0666);
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can not open changes file '" + filename +
+                                    "'"};
+    }
+    return fd;
+}
+
+ChangeWriter::ChangeWriter(osmium::io::File const &file,
+                           osmium::io::overwrite allow_overwrite)
+: m_compressor(osmium::io::CompressionFactory::instance().create_compressor(
+      file.compression(), open_for_writing(file.filename(), allow_overwrite),
+      osmium::io::fsync::no))
+{
+    m_compressor->write("<?xml version='1.0' encoding='UTF-8'?>\n"
+                        "<osmChange version=\"0.6\" "
+                        "generator=\"osm-tags-transform\">\n");
+}
+
+void ChangeWriter::set_operation(operation op)
+{
+    if (op == m_operation) {
+        return;
+    }
+
+    if (m_operation == operation::modify) {
+        m_out.append("  </modify>\n");
+    } else if (m_operation == operation::remove) {
+        m_out.append("  </delete>\n");
+    }
+
+    if (op == operation::modify) {
+        m_out.append("  <modify>\n");
+    } else if (op == operation::remove) {
+        m_out.append("  <delete>\n");
+    }
+
+    m_operation = op;
+}
+
+void ChangeWriter::write_object(osmium::OSMObject const &object)
+{
+    m_out.append("    <");
+    m_out.append(osmium::item_type_to_name(object.type()));
+    m_out.append(" id=\"");
+    m_out.append(std::to_string(object.id()));
+    m_out.append("\" version=\"");
+    m_out.append(std::to_string(object.version()));
+    if (object.timestamp().valid()) {
+        m_out.append("\" timestamp=\"");
+        m_out.append(object.timestamp().to_iso());
+    }
+    m_out.append("\" changeset=\"");
+    m_out.append(std::to_string(object.changeset()));
+    m_out.append("\" uid=\"");
+    m_out.append(std::to_string(object.uid()));
+    m_out.append("\" user=\"");
+    append_xml_encoded(&m_out, object.user());
+    m_out.push_back('"');
+
+    if (object.type() == osmium::item_type::node) {
+        auto const &location =
+            static_cast<osmium::Node const &>(object).location();
+        if (location.valid()) {
+            m_out.append(" lat=\"");
+            append_coordinate(&m_out, location.y());
+            m_out.append("\" lon=\"");
+            append_coordinate(&m_out, location.x());
+            m_out.push_back('"');
+        }
+    }
+
+    bool const has_nodes = object.type() == osmium::item_type::way &&
+                           !static_cast<osmium::Way const &>(object)
+                                .nodes()
+                                .empty();
+    bool const has_members =
+        object.type() == osmium::item_type::relation &&
+        !static_cast<osmium::Relation const &>(object).members().empty();
+
+    if (object.tags().empty() && !has_nodes && !has_members) {
+        m_out.append("/>\n");
+        return;
+    }
+    m_out.append(">\n");
+
+    if (has_nodes) {
+        for (auto const &nr : static_cast<osmium::Way const &>(object).nodes()) {
+            m_out.append("      <nd ref=\"");
+            m_out.append(std::to_string(nr.ref()));
+            m_out.append("\"/>\n");
+        }
+    }
+
+    if (has_members) {
+        for (auto const &member :
+             static_cast<osmium::Relation const &>(object).members()) {
+            m_out.append("      <member type=\"");
+            m_out.append(osmium::item_type_to_name(member.type()));
+            m_out.append("\" ref=\"");
+            m_out.append(std::to_string(member.ref()));
+            m_out.append("\" role=\"");
+            append_xml_encoded(&m_out, member.role());
+            m_out.append("\"/>\n");
+        }
+    }
+
+    for (auto const &tag : object.tags()) {
+        m_out.append("      <tag k=\"");
+        append_xml_encoded(&m_out, tag.key());
+        m_out.append("\" v=\"");
+        append_xml_encoded(&m_out, tag.value());
+        m_out.append("\"/>\n");
+    }
+
+    m_out.append("    </");
+    m_out.append(osmium::item_type_to_name(object.type()));
+    m_out.append(">\n");
+}
+
+ChangeWriter::~ChangeWriter() noexcept
+{
+    // The background task uses this object, it must be done before it
+    // goes away. Errors have been reported already or don't matter now.
+    if (m_pending.valid()) {
+        m_pending.wait();
+    }
+}
+
+void ChangeWriter::write_buffer(osmium::memory::Buffer const &buffer)
+{
+    for (auto const &object : buffer.select<osmium::OSMObject>()) {
+        set_operation(object.visible() ? operation::modify : operation::remove);
+        write_object(object);
+    }
+
+    m_compressor->write(m_out);
+    m_out.clear();
+}
+
+void ChangeWriter::wait()
+{
+    if (m_pending.valid()) {
+        m_pending.get();
+    }
+}
+
+void ChangeWriter::write(osmium::memory::Buffer &&buffer)
+{
+    wait();
+    m_pending = std::async(
+        std::launch::async,
+        [this](osmium::memory::Buffer const &buffer) { write_buffer(buffer); },
+        std::move(buffer));
+}
+
+void ChangeWriter::close()
+{
+    wait();
+    set_operation(operation::none);
+    m_out.append("</osmChange>\n");
+    m_compressor->write(m_out);
+    m_out.clear();
+    m_compressor->close();
+}
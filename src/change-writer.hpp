@@ -0,0 +1,75 @@
+#ifndef CHANGE_WRITER_HPP
+#define CHANGE_WRITER_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include <osmium/io/compression.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/writer_options.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm.hpp>
+
+#include <future>
+#include <memory>
+#include <string>
+
+/**
+ * Writes OSM change files (.osc) with the changed objects as "modify" and
+ * the deleted (invisible) objects as "delete" operations.
+ *
+ * The osmium writer can't be used for this, because it writes all objects
+ * with version 1 as "create" operations. But the objects written here
+ * always exist in the database already, so that would be wrong.
+ *
+ * Formatting and compressing is done in a background thread, one buffer
+ * at a time, while the next buffer is prepared.
+ */
+class ChangeWriter
+{
+public:
+    ChangeWriter(osmium::io::File const &file,
+                 osmium::io::overwrite allow_overwrite);
+
+    ChangeWriter(ChangeWriter const &) = delete;
+    ChangeWriter &operator=(ChangeWriter const &) = delete;
+
+    ChangeWriter(ChangeWriter &&) = delete;
+    ChangeWriter &operator=(ChangeWriter &&) = delete;
+
+    ~ChangeWriter() noexcept;
+
+    /**
+     * Write the objects in the buffer. This returns once the previous
+     * buffer is written. Errors from writing it are thrown here.
+     */
+    void write(osmium::memory::Buffer &&buffer);
+
+    void close();
+
+private:
+    enum class operation
+    {
+        none = 0,
+        modify = 1,
+        remove = 2
+    };
+
+    void set_operation(operation op);
+    void write_object(osmium::OSMObject const &object);
+    void write_buffer(osmium::memory::Buffer const &buffer);
+    void wait();
+
+    std::unique_ptr<osmium::io::Compressor> m_compressor;
+    std::future<void> m_pending;
+    std::string m_out;
+    operation m_operation = operation::none;
+
+}; // class ChangeWriter
+
+#endif // CHANGE_WRITER_HPP
@@ -8,12 +8,22 @@
 
 #include "handler.hpp"
 
+#include "lua-cache.hpp"
+#include "lua-helpers.hpp"
 #include "lua-init.hpp"
 #include "lua-utils.hpp"
 
 #include <osmium/builder/osm_object_builder.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <tuple>
 #include <vector>
 
 prepared_lua_function_t::prepared_lua_function_t(lua_State *lua_state,
@@ -46,27 +56,24 @@ static void *osm_tag_transform_object_metatable =
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-pro-type-const-cast)
 
 static void push_osm_object_to_lua_stack(lua_State *lua_state,
+                                         LuaStringCache *string_cache,
                                          osmium::OSMObject const &object,
                                          osmium::Box const &box)
 {
     assert(lua_state);
 
-    // Table will have 3 fields (id, tags, bbox).
+    // Table will have 3 fields (id, tags, bbox). The tags are only added
+    // when they are first accessed from Lua, see Handler::lua_get_tags().
     constexpr int const max_table_size = 3;
 
     lua_createtable(lua_state, 0, max_table_size);
 
-    luaX_add_table_int(lua_state, "id", object.id());
-
-    lua_pushliteral(lua_state, "tags");
-    lua_createtable(lua_state, 0, static_cast<int>(object.tags().size()));
-    for (auto const &tag : object.tags()) {
-        luaX_add_table_str(lua_state, tag.key(), tag.value());
-    }
+    string_cache->push(lua_state, "id");
+    lua_pushinteger(lua_state, object.id());
     lua_rawset(lua_state, -3);
 
     if (box.valid()) {
-        lua_pushliteral(lua_state, "bbox");
+        string_cache->push(lua_state, "bbox");
 
         lua_createtable(lua_state, 4, 0);
 
@@ -95,17 +102,31 @@ static void push_osm_object_to_lua_stack(lua_State *lua_state,
     lua_setmetatable(lua_state, -2);
 }
 
-Handler::Handler(std::string const &filename, std::string const &index_name,
-                 geom_proc_type geom_proc, untagged_mode untagged)
-: m_geom_proc(geom_proc), m_untagged(untagged)
+static int lua_trampoline_get_tags(lua_State *lua_state)
 {
-    if (m_geom_proc != geom_proc_type::none) {
-        const auto &map_factory =
-            osmium::index::MapFactory<osmium::unsigned_object_id_type,
-                                      osmium::Location>::instance();
-        m_node_location_index = map_factory.create_map(index_name);
-    }
+    return static_cast<Handler *>(luaX_get_context(lua_state))->lua_get_tags();
+}
+
+static int lua_trampoline_get_tag(lua_State *lua_state)
+{
+    return static_cast<Handler *>(luaX_get_context(lua_state))->lua_get_tag();
+}
+
+static int lua_trampoline_set_tag(lua_State *lua_state)
+{
+    return static_cast<Handler *>(luaX_get_context(lua_state))->lua_set_tag();
+}
+
+static int lua_trampoline_delete_tag(lua_State *lua_state)
+{
+    return static_cast<Handler *>(luaX_get_context(lua_state))
+        ->lua_delete_tag();
+}
 
+Handler::Handler(std::string const &filename, LocationIndexes *indexes,
+                 untagged_mode untagged, std::string const &lua_cache_dir)
+: m_lua_cache(lua_cache_dir), m_indexes(indexes), m_untagged(untagged)
+{
     m_lua_state.reset(luaL_newstate(),
                       [](lua_State *state) { lua_close(state); });
 
@@ -117,6 +138,8 @@ Handler::Handler(std::string const &filename, std::string const &index_name,
 
     luaX_add_table_str(lua_state(), "version", "0.1");
 
+    luaX_add_helper_functions(lua_state());
+
     /*std::string const dir_path =
     boost::filesystem::path{filename}.parent_path().string();
     luaX_add_table_str(lua_state(), "config_dir", dir_path.c_str());*/
@@ -126,8 +149,18 @@ Handler::Handler(std::string const &filename, std::string const &index_name,
     // Clean up stack
     lua_settop(lua_state(), 0);
 
+    // Set up global "object_functions" with the functions on OSM objects
+    // implemented in C++. They are picked up by the init.lua script.
+    lua_newtable(lua_state());
+    luaX_add_table_func(lua_state(), "get_tags", lua_trampoline_get_tags);
+    luaX_add_table_func(lua_state(), "get_tag", lua_trampoline_get_tag);
+    luaX_add_table_func(lua_state(), "set_tag", lua_trampoline_set_tag);
+    luaX_add_table_func(lua_state(), "delete_tag", lua_trampoline_delete_tag);
+    lua_setglobal(lua_state(), "object_functions");
+
     // Load compiled in init.lua
-    if (luaL_dostring(lua_state(), lua_init())) {
+    if (m_lua_cache.load_string(lua_state(), lua_init(), "=init.lua") ||
+        lua_pcall(lua_state(), 0, 0, 0)) {
         throw std::runtime_error{std::string{"Internal error in Lua setup: "} +
                                  lua_tostring(lua_state(), -1)};
     }
@@ -140,10 +173,15 @@ Handler::Handler(std::string const &filename, std::string const &index_name,
     lua_settable(lua_state(), LUA_REGISTRYINDEX);
     lua_pushnil(lua_state());
     lua_setglobal(lua_state(), "object_metatable");
+    lua_pushnil(lua_state());
+    lua_setglobal(lua_state(), "object_functions");
 
-    // Load user config file
+    // Load user config file, modules loaded with require() from the
+    // config go through the cache, too.
+    m_lua_cache.install_searcher(lua_state());
     luaX_set_context(lua_state(), this);
-    if (luaL_dofile(lua_state(), filename.c_str())) {
+    if (m_lua_cache.load_file(lua_state(), filename) ||
+        lua_pcall(lua_state(), 0, LUA_MULTRET, 0)) {
         throw std::runtime_error{std::string{"Error loading lua config: "} +
                                  lua_tostring(lua_state(), -1)};
     }
@@ -162,14 +200,19 @@ Handler::Handler(std::string const &filename, std::string const &index_name,
     lua_remove(lua_state(), 1); // global "ott"
 }
 
-void Handler::call_lua_function(prepared_lua_function_t func,
+void Handler::call_lua_function(prepared_lua_function_t const &func,
                                 osmium::OSMObject const &object,
                                 osmium::Box const &box)
 {
     m_calling_context = func.context();
+    m_tag_edits.clear();
+
+    if (m_slow_objects) {
+        m_start_time = std::chrono::steady_clock::now();
+    }
 
     lua_pushvalue(lua_state(), func.index()); // the function to call
-    push_osm_object_to_lua_stack(lua_state(), object, box);
+    push_osm_object_to_lua_stack(lua_state(), &m_string_cache, object, box);
 
     luaX_set_context(lua_state(), this);
     if (luaX_pcall(lua_state(), 1, func.nresults())) {
@@ -181,17 +224,67 @@ void Handler::call_lua_function(prepared_lua_function_t func,
     m_calling_context = calling_context::main;
 }
 
+/**
+ * Record the time since the Lua function was called for the object. This
+ * is called after the output object has been built, so that building it
+ * from a large tags table returned by Lua is included.
+ */
+void Handler::trace_time(osmium::OSMObject const &object)
+{
+    if (m_slow_objects) {
+        m_slow_objects->add(object,
+                            std::chrono::steady_clock::now() - m_start_time);
+    }
+}
+
+bool Handler::survives(osmium::OSMObject const &object,
+                       osmium::Box const &box)
+{
+    auto const &func = object.type() == osmium::item_type::way
+                           ? m_process_way
+                           : m_process_relation;
+
+    if (!func ||
+        (object.tags().empty() && m_untagged != untagged_mode::process)) {
+        return m_untagged == untagged_mode::copy;
+    }
+
+    if (object.type() == osmium::item_type::way) {
+        m_context_way = &static_cast<osmium::Way const &>(object);
+    } else {
+        m_context_relation = &static_cast<osmium::Relation const &>(object);
+    }
+    call_lua_function(func, object, box);
+    m_context_way = nullptr;
+    m_context_relation = nullptr;
+
+    auto const lt = lua_type(lua_state(), -1);
+    if (lt != LUA_TBOOLEAN && lt != LUA_TTABLE) {
+        throw std::runtime_error{
+            "Processing functions should return true, false, or tags table"};
+    }
+    bool const keep = lt == LUA_TTABLE || lua_toboolean(lua_state(), -1);
+    lua_pop(lua_state(), 1); // return value
+
+    return keep;
+}
+
 bool Handler::handle_boolean_return(osmium::OSMObject const &object)
 {
     auto const lt = lua_type(lua_state(), -1);
 
-    // true means: return object as is
+    // true means: return object as is (or with the tag edits applied)
     // false means: remove object completely
     if (lt == LUA_TBOOLEAN) {
-        if (lua_toboolean(lua_state(), -1)) {
+        if (!lua_toboolean(lua_state(), -1)) {
+            drop_object(object);
+            return true;
+        }
+        if (m_tag_edits.empty()) {
             m_out_buffer->add_item(object);
+            return true;
         }
-        return true;
+        return false;
     }
 
     if (lt != LUA_TTABLE) {
@@ -202,6 +295,339 @@ bool Handler::handle_boolean_return(osmium::OSMObject const &object)
     return false;
 }
 
+template <typename TBuilder>
+void copy_attributes(TBuilder *builder, osmium::OSMObject const &object)
+{
+    builder->set_id(object.id());
+    builder->set_version(object.version());
+    builder->set_changeset(object.changeset());
+    builder->set_timestamp(object.timestamp());
+    builder->set_uid(object.uid());
+    builder->set_user(object.user());
+}
+
+/**
+ * Called for every object that is not written to the output. If the object
+ * is referenced from other objects and we are asked to keep those, it is
+ * written anyway.
+ *
+ * Untagged objects dropped because of "-u drop" are not written to the
+ * changes file. Most of them are way nodes, the change file would be
+ * mostly deletes of those otherwise.
+ */
+void Handler::drop_object(osmium::OSMObject const &object)
+{
+    if (!m_referenced_ids || !m_referenced_ids->contains(object)) {
+        if (!object.tags().empty() || m_untagged != untagged_mode::drop) {
+            add_deleted_change(object);
+        }
+        return;
+    }
+
+    if (m_keep_referenced == keep_referenced_mode::copy) {
+        m_out_buffer->add_item(object);
+    } else if (m_keep_referenced == keep_referenced_mode::untagged) {
+        add_untagged_copy(object);
+        add_modified_change(object);
+    }
+}
+
+/**
+ * When collecting the referenced ids, the Lua functions were called for all
+ * ways and relations already. Those dropped then are dropped now without
+ * calling Lua again, so that a config with state (counters, random
+ * sampling, ...) can not decide differently and keep an object whose
+ * references were not collected. Objects which survived then but are
+ * dropped now only mean some unneeded references are kept.
+ */
+bool Handler::survived(osmium::OSMObject const &object) const noexcept
+{
+    return !m_referenced_ids || m_referenced_ids->survived(object);
+}
+
+/// Do both tag lists contain the same tags, ignoring the order?
+static bool same_tags(osmium::TagList const &a, osmium::TagList const &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (auto const &tag : a) {
+        char const *const value = b.get_value_by_key(tag.key());
+        if (!value || std::strcmp(value, tag.value()) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Add the object just written to the output buffer (but not yet committed)
+ * to the changes buffer if its tags are different from the original object.
+ */
+void Handler::add_modified_change(osmium::OSMObject const &original)
+{
+    if (!m_changes_buffer) {
+        return;
+    }
+
+    auto const &changed =
+        m_out_buffer->get<osmium::OSMObject>(m_out_buffer->committed());
+    if (same_tags(original.tags(), changed.tags())) {
+        return;
+    }
+
+    m_changes_buffer->add_item(changed);
+    m_changes_buffer->commit();
+}
+
+void Handler::add_deleted_change(osmium::OSMObject const &object)
+{
+    if (!m_changes_buffer) {
+        return;
+    }
+
+    auto &deleted = m_changes_buffer->add_item(object);
+    deleted.set_visible(false);
+    m_changes_buffer->commit();
+}
+
+void Handler::add_untagged_copy(osmium::OSMObject const &object)
+{
+    switch (object.type()) {
+    case osmium::item_type::node: {
+        osmium::builder::NodeBuilder builder{*m_out_buffer};
+        copy_attributes(&builder, object);
+        builder.set_location(static_cast<osmium::Node const &>(object).location());
+        break;
+    }
+    case osmium::item_type::way: {
+        osmium::builder::WayBuilder builder{*m_out_buffer};
+        copy_attributes(&builder, object);
+        builder.add_item(static_cast<osmium::Way const &>(object).nodes());
+        break;
+    }
+    case osmium::item_type::relation: {
+        osmium::builder::RelationBuilder builder{*m_out_buffer};
+        copy_attributes(&builder, object);
+        builder.add_item(
+            static_cast<osmium::Relation const &>(object).members());
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+osmium::OSMObject const *Handler::context_object() const noexcept
+{
+    switch (m_calling_context) {
+    case calling_context::process_node:
+        return m_context_node;
+    case calling_context::process_way:
+        return m_context_way;
+    case calling_context::process_relation:
+        return m_context_relation;
+    default:
+        break;
+    }
+    return nullptr;
+}
+
+/**
+ * Check that the Lua table at the specified index on the stack is the
+ * object currently being processed.
+ */
+bool Handler::is_context_object(int index)
+{
+    auto const *object = context_object();
+    if (!object || lua_type(lua_state(), index) != LUA_TTABLE) {
+        return false;
+    }
+
+    lua_pushliteral(lua_state(), "id");
+    lua_rawget(lua_state(), index);
+    bool const same_id = lua_tointeger(lua_state(), -1) == object->id();
+    lua_pop(lua_state(), 1);
+
+    return same_id;
+}
+
+int Handler::lua_get_tags()
+{
+    if (!is_context_object(1)) {
+        return luaL_error(lua_state(), "Tags are only available on the object "
+                                       "given to the current callback");
+    }
+
+    // Edits recorded earlier in this callback are applied on top of the
+    // original tags.
+    auto const &tags = context_object()->tags();
+    lua_createtable(lua_state(), 0,
+                    static_cast<int>(tags.size() + m_tag_edits.size()));
+    for (auto const &tag : tags) {
+        m_string_cache.push(lua_state(), tag.key());
+        m_string_cache.push(lua_state(), tag.value());
+        lua_rawset(lua_state(), -3);
+    }
+    for (auto const &edit : m_tag_edits) {
+        m_string_cache.push(lua_state(), edit.key.c_str());
+        if (edit.remove) {
+            lua_pushnil(lua_state());
+        } else {
+            m_string_cache.push(lua_state(), edit.value.c_str());
+        }
+        lua_rawset(lua_state(), -3);
+    }
+
+    return 1;
+}
+
+int Handler::lua_get_tag()
+{
+    if (!is_context_object(1)) {
+        return luaL_error(lua_state(), "get_tag() can only be called on the "
+                                       "object given to the current callback");
+    }
+
+    char const *const key = luaL_checkstring(lua_state(), 2);
+
+    // Edits recorded earlier in this callback take precedence.
+    auto const it =
+        std::find_if(m_tag_edits.cbegin(), m_tag_edits.cend(),
+                     [&](tag_edit const &edit) { return edit.key == key; });
+    if (it != m_tag_edits.cend()) {
+        if (it->remove) {
+            lua_pushnil(lua_state());
+        } else {
+            m_string_cache.push(lua_state(), it->value.c_str());
+        }
+        return 1;
+    }
+
+    char const *const value = context_object()->tags().get_value_by_key(key);
+    if (value) {
+        m_string_cache.push(lua_state(), value);
+    } else {
+        lua_pushnil(lua_state());
+    }
+
+    return 1;
+}
+
+int Handler::lua_set_tag()
+{
+    if (!is_context_object(1)) {
+        return luaL_error(lua_state(), "set_tag() can only be called on the "
+                                       "object given to the current callback");
+    }
+
+    add_tag_edit(luaL_checkstring(lua_state(), 2),
+                 luaL_checkstring(lua_state(), 3));
+    update_tags_table();
+
+    return 0;
+}
+
+int Handler::lua_delete_tag()
+{
+    if (!is_context_object(1)) {
+        return luaL_error(lua_state(), "delete_tag() can only be called on the "
+                                       "object given to the current callback");
+    }
+
+    add_tag_edit(luaL_checkstring(lua_state(), 2), nullptr);
+    lua_settop(lua_state(), 2);
+    update_tags_table();
+
+    return 0;
+}
+
+/**
+ * If the tags table of the object (at index 1 on the stack) has been
+ * created already, set the key at index 2 to the value at index 3 (nil if
+ * there is none) in it, so that it stays the same as the edited tags.
+ */
+void Handler::update_tags_table()
+{
+    lua_pushliteral(lua_state(), "tags");
+    lua_rawget(lua_state(), 1);
+    if (lua_type(lua_state(), -1) == LUA_TTABLE) {
+        lua_pushvalue(lua_state(), 2);
+        lua_pushvalue(lua_state(), 3);
+        lua_rawset(lua_state(), -3);
+    }
+    lua_pop(lua_state(), 1); // tags table
+}
+
+/**
+ * Record a tag edit. If value is nullptr, the tag will be removed. A later
+ * edit of the same key replaces an earlier one.
+ */
+void Handler::add_tag_edit(char const *key, char const *value)
+{
+    auto it = std::find_if(m_tag_edits.begin(), m_tag_edits.end(),
+                           [&](tag_edit const &edit) { return edit.key == key; });
+    if (it == m_tag_edits.end()) {
+        m_tag_edits.emplace_back();
+        it = std::prev(m_tag_edits.end());
+        it->key = key;
+    }
+
+    if (value) {
+        it->value = value;
+        it->remove = false;
+    } else {
+        it->value.clear();
+        it->remove = true;
+    }
+}
+
+static void add_tag_or_warn(osmium::builder::TagListBuilder *builder,
+                            char const *key, char const *value)
+{
+    try {
+        builder->add_tag(key, value);
+    } catch (std::length_error const &e) {
+        std::cerr << "Warning: Length of tag key or value exceeded. "
+                     "Ignoring tag...\n";
+    }
+}
+
+/**
+ * Add the tags from the original tag list with the tag edits applied. This
+ * is done in one pass over the original tags which keep their order, new
+ * tags are appended at the end.
+ */
+template <typename TBuilder>
+void add_edited_tags(TBuilder *builder, osmium::TagList const &tags,
+                     std::vector<tag_edit> *edits)
+{
+    osmium::builder::TagListBuilder tl_builder{*builder};
+
+    for (auto const &tag : tags) {
+        auto const it =
+            std::find_if(edits->begin(), edits->end(), [&](tag_edit const &edit) {
+                return edit.key == tag.key();
+            });
+        if (it == edits->end()) {
+            tl_builder.add_tag(tag);
+            continue;
+        }
+        it->applied = true;
+        if (!it->remove) {
+            add_tag_or_warn(&tl_builder, tag.key(), it->value.c_str());
+        }
+    }
+
+    for (auto const &edit : *edits) {
+        if (!edit.applied && !edit.remove) {
+            add_tag_or_warn(&tl_builder, edit.key.c_str(), edit.value.c_str());
+        }
+    }
+}
+
 template <typename TBuilder>
 void add_tags(lua_State *lua_state, TBuilder *builder)
 {
@@ -226,182 +652,283 @@ void add_tags(lua_State *lua_state, TBuilder *builder)
     std::sort(tags.begin(), tags.end());
     osmium::builder::TagListBuilder tl_builder{*builder};
     for (auto const &kv : tags) {
-        try {
-            tl_builder.add_tag(kv.first, kv.second);
-        } catch (std::length_error const &e) {
-            std::cerr << "Warning: Length of tag key or value exceeded. "
-                         "Ignoring tag...\n";
+        add_tag_or_warn(&tl_builder, kv.first.c_str(), kv.second.c_str());
+    }
+}
+
+void Handler::resume_after(osmium::item_type type, osmium::object_id_type id)
+{
+    m_resume_type = type;
+    m_resume_id = id;
+}
+
+/**
+ * Has this object been handled in an earlier run already? Objects are
+ * compared in the same order they are sorted in OSM files: by type, then
+ * negative ids before positive ids, then by absolute id.
+ */
+bool Handler::already_done(osmium::OSMObject const &object) noexcept
+{
+    if (m_resume_type == osmium::item_type::undefined) {
+        return false;
+    }
+
+    auto const a = std::make_tuple(object.type(), object.id() > 0,
+                                   object.positive_id());
+    auto const b = std::make_tuple(
+        m_resume_type, m_resume_id > 0,
+        static_cast<osmium::unsigned_object_id_type>(std::abs(m_resume_id)));
+    if (a <= b) {
+        return true;
+    }
+
+    // Input is sorted, so we'll never see an object from before the
+    // resume position again.
+    m_resume_type = osmium::item_type::undefined;
+    return false;
+}
+
+osmium::Box Handler::index_node(osmium::Node const &node)
+{
+    osmium::Box box;
+
+    if (m_indexes) {
+        if (!m_way_boxes) {
+            m_indexes->add_node(node);
         }
+        box = osmium::Box{node.location(), node.location()};
     }
+
+    return box;
 }
 
 void Handler::node(osmium::Node const &node)
 {
+    osmium::Box const box = index_node(node);
+
+    if (already_done(node)) {
+        return;
+    }
+
     if (!m_process_node || (node.tags().empty() && m_untagged != untagged_mode::process)) {
         if (m_untagged == untagged_mode::copy) {
             m_out_buffer->add_item(node);
-            m_out_buffer->commit();
+        } else {
+            drop_object(node);
         }
+        m_out_buffer->commit();
         return;
     }
 
-    osmium::Box box;
-
-    if (m_geom_proc != geom_proc_type::none) {
-        m_node_location_index->set(node.positive_id(), node.location());
-        box = osmium::Box{node.location(), node.location()};
-    }
-
     m_context_node = &node;
     call_lua_function(m_process_node, node, box);
     m_context_node = nullptr;
 
-    if (!handle_boolean_return(node)) {
+    bool const rebuild = !handle_boolean_return(node);
+    if (rebuild) {
         osmium::builder::NodeBuilder builder{*m_out_buffer};
-        builder.set_id(node.id());
-        builder.set_version(node.version());
-        builder.set_changeset(node.changeset());
-        builder.set_timestamp(node.timestamp());
-        builder.set_uid(node.uid());
+        copy_attributes(&builder, node);
         builder.set_location(node.location());
-        builder.set_user(node.user());
 
-        add_tags(lua_state(), &builder);
+        if (lua_type(lua_state(), -1) == LUA_TTABLE) {
+            add_tags(lua_state(), &builder);
+        } else {
+            add_edited_tags(&builder, node.tags(), &m_tag_edits);
+        }
     }
 
     lua_pop(lua_state(), 1); // return value (a table)
 
+    if (rebuild) {
+        add_modified_change(node);
+    }
+
     m_out_buffer->commit();
+    trace_time(node);
 }
 
-void Handler::find_bounding_box(osmium::Box *box, osmium::Way const &way)
+/**
+ * Get the bounding box of the way. If the input buffer is known, the
+ * boxes of all ways in it are calculated together when the first way is
+ * seen. This works because all ways in the buffer are handed to way() in
+ * order.
+ */
+osmium::Box Handler::way_box(osmium::Way const &way)
+{
+    if (!m_input_buffer) {
+        return m_indexes->way_box(way);
+    }
+
+    if (m_next_way_box == 0) {
+        m_indexes->calculate_way_boxes(*m_input_buffer, &m_way_box_batch);
+    }
+
+    assert(m_next_way_box < m_way_box_batch.boxes.size());
+    return m_way_box_batch.boxes[m_next_way_box++];
+}
+
+osmium::Box Handler::index_way(osmium::Way const &way)
 {
-    for (auto const &nr : way.nodes()) {
-        auto const location =
-            m_node_location_index->get_noexcept(nr.positive_ref());
-        if (location) {
-            box->extend(location);
+    osmium::Box box;
+
+    if (m_indexes) {
+        if (m_way_boxes) {
+            box = way_box(way);
+            if (box.valid()) {
+                m_way_boxes->emplace_back(way.positive_id(), box);
+            }
+        } else {
+            m_indexes->prepare_ways();
+            box = way_box(way);
+            if (box.valid()) {
+                m_indexes->add_way(way.positive_id(), box);
+            }
         }
     }
+
+    return box;
 }
 
 void Handler::way(osmium::Way const &way)
 {
+    osmium::Box const box = index_way(way);
+
+    if (already_done(way)) {
+        return;
+    }
+
     if (!m_process_way || (way.tags().empty() && m_untagged != untagged_mode::process)) {
         if (m_untagged == untagged_mode::copy) {
             m_out_buffer->add_item(way);
-            m_out_buffer->commit();
+        } else {
+            drop_object(way);
         }
+        m_out_buffer->commit();
         return;
     }
 
-    osmium::Box box;
-
-    if (m_geom_proc != geom_proc_type::none) {
-        if (m_must_sort_node_index) {
-            m_node_location_index->sort();
-            m_must_sort_node_index = false;
-        }
-        find_bounding_box(&box, way);
-        if (box.valid()) {
-            m_way_location_index.set(way.positive_id(), box);
-        }
+    if (!survived(way)) {
+        drop_object(way);
+        m_out_buffer->commit();
+        return;
     }
 
     m_context_way = &way;
     call_lua_function(m_process_way, way, box);
     m_context_way = nullptr;
 
-    if (!handle_boolean_return(way)) {
+    bool const rebuild = !handle_boolean_return(way);
+    if (rebuild) {
         osmium::builder::WayBuilder builder{*m_out_buffer};
-        builder.set_id(way.id());
-        builder.set_version(way.version());
-        builder.set_changeset(way.changeset());
-        builder.set_timestamp(way.timestamp());
-        builder.set_uid(way.uid());
-        builder.set_user(way.user());
+        copy_attributes(&builder, way);
 
         builder.add_item(way.nodes());
 
-        add_tags(lua_state(), &builder);
+        if (lua_type(lua_state(), -1) == LUA_TTABLE) {
+            add_tags(lua_state(), &builder);
+        } else {
+            add_edited_tags(&builder, way.tags(), &m_tag_edits);
+        }
     }
 
     lua_pop(lua_state(), 1); // return value (a table)
 
+    if (rebuild) {
+        add_modified_change(way);
+    }
+
     m_out_buffer->commit();
+    trace_time(way);
 }
 
-void Handler::find_bounding_box(osmium::Box *box,
-                                osmium::Relation const &relation)
+void Handler::relation(osmium::Relation const &relation)
 {
-    for (auto const &member : relation.members()) {
-        if (member.type() == osmium::item_type::node) {
-            auto const location =
-                m_node_location_index->get_noexcept(member.positive_ref());
-            if (location) {
-                box->extend(location);
-            }
-        } else if (member.type() == osmium::item_type::way) {
-            auto const wbox =
-                m_way_location_index.get_noexcept(member.positive_ref());
-            if (wbox.valid()) {
-                box->extend(wbox);
-            }
-        }
+    if (already_done(relation)) {
+        return;
     }
-}
 
-void Handler::relation(osmium::Relation const &relation)
-{
     if (!m_process_relation || (relation.tags().empty() && m_untagged != untagged_mode::process)) {
         if (m_untagged == untagged_mode::copy) {
             m_out_buffer->add_item(relation);
-            m_out_buffer->commit();
+        } else {
+            drop_object(relation);
         }
+        m_out_buffer->commit();
+        return;
+    }
+
+    if (!survived(relation)) {
+        drop_object(relation);
+        m_out_buffer->commit();
         return;
     }
 
     osmium::Box box;
 
-    if (m_geom_proc != geom_proc_type::none) {
-        if (m_must_sort_way_index) {
-            m_way_location_index.sort();
-            m_must_sort_way_index = false;
+    if (m_indexes) {
+        if (!m_way_boxes) {
+            m_indexes->prepare_relations();
         }
-        find_bounding_box(&box, relation);
+        box = m_indexes->relation_box(relation);
     }
 
     m_context_relation = &relation;
     call_lua_function(m_process_relation, relation, box);
     m_context_relation = nullptr;
 
-    if (!handle_boolean_return(relation)) {
+    bool const rebuild = !handle_boolean_return(relation);
+    if (rebuild) {
         osmium::builder::RelationBuilder builder{*m_out_buffer};
-        builder.set_id(relation.id());
-        builder.set_version(relation.version());
-        builder.set_changeset(relation.changeset());
-        builder.set_timestamp(relation.timestamp());
-        builder.set_uid(relation.uid());
-        builder.set_user(relation.user());
+        copy_attributes(&builder, relation);
 
         builder.add_item(relation.members());
 
-        add_tags(lua_state(), &builder);
+        if (lua_type(lua_state(), -1) == LUA_TTABLE) {
+            add_tags(lua_state(), &builder);
+        } else {
+            add_edited_tags(&builder, relation.tags(), &m_tag_edits);
+        }
     }
 
     lua_pop(lua_state(), 1); // return value
 
+    if (rebuild) {
+        add_modified_change(relation);
+    }
+
     m_out_buffer->commit();
+    trace_time(relation);
 }
 
-void Handler::output_memory_used(osmium::VerboseOutput *vout)
+osmium::osm_entity_bits::type Handler::needed_entities() const noexcept
 {
-    constexpr auto const mbytes = 1024UL * 1024UL;
+    // Objects of types without process function are copied to the output
+    // in copy mode, and any object can be kept if it is referenced.
+    bool const copy_all = m_untagged == untagged_mode::copy ||
+                          m_keep_referenced != keep_referenced_mode::none;
 
-    if (m_node_location_index) {
-        *vout << "Memory used for node locations: "
-              << (m_node_location_index->used_memory() / mbytes) << "MBytes\n";
-        *vout << "Memory used for way locations: "
-              << (m_way_location_index.used_memory() / mbytes) << "MBytes\n";
+    auto entities = osmium::osm_entity_bits::nothing;
+
+    if (copy_all || m_process_node) {
+        entities |= osmium::osm_entity_bits::node;
+    }
+    if (copy_all || m_process_way) {
+        entities |= osmium::osm_entity_bits::way;
+    }
+    if (copy_all || m_process_relation) {
+        entities |= osmium::osm_entity_bits::relation;
+    }
+
+    // The location indexes need the nodes for way bboxes and the ways for
+    // relation bboxes.
+    if (m_indexes) {
+        if (m_process_way || m_process_relation) {
+            entities |= osmium::osm_entity_bits::node;
+        }
+        if (m_process_relation) {
+            entities |= osmium::osm_entity_bits::way;
+        }
     }
+
+    return entities;
 }
@@ -9,11 +9,15 @@
  * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
  */
 
+#include "location-indexes.hpp"
+#include "lua-cache.hpp"
+#include "lua-string-cache.hpp"
+#include "referenced-ids.hpp"
+#include "slow-objects.hpp"
+
 #include <osmium/handler.hpp>
-#include <osmium/index/map/flex_mem.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm.hpp>
-#include <osmium/util/verbose_output.hpp>
 
 extern "C"
 {
@@ -21,8 +25,11 @@ extern "C"
 #include <lualib.h>
 }
 
+#include <chrono>
+#include <cstddef>
 #include <memory>
 #include <string>
+#include <vector>
 
 enum class geom_proc_type
 {
@@ -36,6 +43,13 @@ enum class untagged_mode {
     process = 2
 };
 
+enum class keep_referenced_mode
+{
+    none = 0,
+    copy = 1,
+    untagged = 2
+};
+
 /**
  * When C++ code is called from the Lua code we sometimes need to know
  * in what context this happens. These are the possible contexts.
@@ -92,56 +106,182 @@ private:
     calling_context m_calling_context = calling_context::main;
 }; // class prepared_lua_function_t
 
+/**
+ * A change to the tags of an object recorded through the set_tag() and
+ * delete_tag() functions in Lua.
+ */
+struct tag_edit
+{
+    std::string key;
+    std::string value;
+    bool remove = false;
+    bool applied = false;
+}; // struct tag_edit
+
 class Handler : public osmium::handler::Handler
 {
 public:
-    Handler(std::string const &filename, std::string const &index_name,
-            geom_proc_type geom_proc, untagged_mode untagged);
+    /**
+     * Create handler for the specified config file. If indexes is not
+     * nullptr, geometry processing is enabled using those indexes.
+     * Compiled Lua code is cached in lua_cache_dir (if not empty).
+     */
+    Handler(std::string const &filename, LocationIndexes *indexes,
+            untagged_mode untagged, std::string const &lua_cache_dir);
 
     void set_buffer(osmium::memory::Buffer *buffer) { m_out_buffer = buffer; }
 
+    /**
+     * Set the input buffer which is about to be processed. If this is
+     * set, the bounding boxes of all ways in the buffer are calculated
+     * together when the first way is processed.
+     */
+    void set_input_buffer(osmium::memory::Buffer const *buffer) noexcept
+    {
+        m_input_buffer = buffer;
+        m_next_way_box = 0;
+    }
+
+    /**
+     * Set buffer for objects with changed tags and deleted objects. If
+     * this is not set, changes are not recorded.
+     */
+    void set_changes_buffer(osmium::memory::Buffer *buffer) noexcept
+    {
+        m_changes_buffer = buffer;
+    }
+
+    /**
+     * Keep objects which would otherwise be dropped if they are in the
+     * referenced_ids set.
+     */
+    void keep_referenced(ReferencedIds const *referenced_ids,
+                         keep_referenced_mode mode) noexcept
+    {
+        m_referenced_ids = referenced_ids;
+        m_keep_referenced = mode;
+    }
+
+    /**
+     * Resume an earlier run: All objects up to and including the object
+     * with the specified type and id are assumed to be in the output
+     * already. They are not processed again, but they are still added to
+     * the location indexes.
+     */
+    void resume_after(osmium::item_type type, osmium::object_id_type id);
+
+    /**
+     * Measure the time the Lua processing functions take for each object
+     * and record it in slow_objects.
+     */
+    void trace_slow_objects(SlowObjects *slow_objects) noexcept
+    {
+        m_slow_objects = slow_objects;
+    }
+
+    /**
+     * Only read from the location indexes, so that several handlers can
+     * work in parallel. Node locations must be added by the caller, who
+     * also has to call LocationIndexes::prepare_ways() and
+     * prepare_relations() at the right time. Way bounding boxes are added
+     * to way_boxes instead of the index.
+     */
+    void use_indexes_read_only(way_boxes_type *way_boxes) noexcept
+    {
+        m_way_boxes = way_boxes;
+    }
+
+    /**
+     * Call the Lua function for the way or relation only to find out
+     * whether it would be in the output (possibly with changed tags).
+     * Nothing is written. Objects dropped here can still be kept in the
+     * real run because they are referenced.
+     */
+    bool survives(osmium::OSMObject const &object, osmium::Box const &box);
+
     void node(osmium::Node const &node);
     void way(osmium::Way const &way);
     void relation(osmium::Relation const &relation);
 
-    void output_memory_used(osmium::VerboseOutput *vout);
+    /**
+     * The types of objects which must be read from the input. Objects of
+     * other types can never reach the output and are not needed for the
+     * location indexes.
+     */
+    osmium::osm_entity_bits::type needed_entities() const noexcept;
+
+    LuaStringCache const &string_cache() const noexcept
+    {
+        return m_string_cache;
+    }
 
-private:
-    using node_index_type =
-        osmium::index::map::Map<osmium::unsigned_object_id_type,
-                                osmium::Location>;
-    using way_index_type =
-        osmium::index::map::FlexMem<osmium::unsigned_object_id_type,
-                                    osmium::Box>;
+    LuaCache const &lua_cache() const noexcept { return m_lua_cache; }
 
+    // Functions called from Lua on OSM objects
+    int lua_get_tags();
+    int lua_get_tag();
+    int lua_set_tag();
+    int lua_delete_tag();
+
+private:
     lua_State *lua_state() noexcept { return m_lua_state.get(); }
 
-    void find_bounding_box(osmium::Box *box, osmium::Way const &way);
-    void find_bounding_box(osmium::Box *box, osmium::Relation const &relation);
+    bool already_done(osmium::OSMObject const &object) noexcept;
+
+    osmium::Box index_node(osmium::Node const &node);
+    osmium::Box index_way(osmium::Way const &way);
+    osmium::Box way_box(osmium::Way const &way);
 
-    void call_lua_function(prepared_lua_function_t func,
+    void call_lua_function(prepared_lua_function_t const &func,
                            osmium::OSMObject const &object,
                            osmium::Box const &box);
+    void trace_time(osmium::OSMObject const &object);
 
     bool handle_boolean_return(osmium::OSMObject const &object);
 
+    bool survived(osmium::OSMObject const &object) const noexcept;
+    void drop_object(osmium::OSMObject const &object);
+    void add_untagged_copy(osmium::OSMObject const &object);
+    void add_modified_change(osmium::OSMObject const &original);
+    void add_deleted_change(osmium::OSMObject const &object);
+
+    osmium::OSMObject const *context_object() const noexcept;
+    bool is_context_object(int index);
+    void add_tag_edit(char const *key, char const *value);
+    void update_tags_table();
+
+    osmium::memory::Buffer const *m_input_buffer = nullptr;
     osmium::memory::Buffer *m_out_buffer = nullptr;
+    osmium::memory::Buffer *m_changes_buffer = nullptr;
+
+    // Each handler has its own cache, because modules can be loaded
+    // with require() while processing in the worker threads.
+    LuaCache m_lua_cache;
     std::shared_ptr<lua_State> m_lua_state;
     prepared_lua_function_t m_process_node;
     prepared_lua_function_t m_process_way;
     prepared_lua_function_t m_process_relation;
     calling_context m_calling_context = calling_context::main;
+    LuaStringCache m_string_cache;
 
-    std::unique_ptr<node_index_type> m_node_location_index;
-    way_index_type m_way_location_index;
+    LocationIndexes *m_indexes;
+    way_boxes_type *m_way_boxes = nullptr;
+    way_box_batch m_way_box_batch;
+    std::size_t m_next_way_box = 0;
     osmium::Node const *m_context_node = nullptr;
     osmium::Way const *m_context_way = nullptr;
     osmium::Relation const *m_context_relation = nullptr;
+    std::vector<tag_edit> m_tag_edits;
+
+    ReferencedIds const *m_referenced_ids = nullptr;
+    SlowObjects *m_slow_objects = nullptr;
+    std::chrono::steady_clock::time_point m_start_time;
+
+    osmium::item_type m_resume_type = osmium::item_type::undefined;
+    osmium::object_id_type m_resume_id = 0;
 
-    geom_proc_type m_geom_proc;
     untagged_mode m_untagged;
-    bool m_must_sort_node_index = true;
-    bool m_must_sort_way_index = true;
+    keep_referenced_mode m_keep_referenced = keep_referenced_mode::none;
 
 }; // class Handler
 
@@ -0,0 +1,168 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "index-selection.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+
+// These numbers are rough estimates based on the planet file. The largest
+// ids are somewhat larger than those currently in use, so that they are
+// good for some time.
+static constexpr double const max_node_id = 13.0e9;
+static constexpr double const max_way_id = 1.5e9;
+static constexpr double const nodes_per_way = 8.0;
+
+// Average number of bytes per node (including the ways and relations) in
+// PBF or compressed files and in uncompressed XML or OPL files.
+static constexpr double const bytes_per_node_compressed = 8.0;
+static constexpr double const bytes_per_node_uncompressed = 80.0;
+
+// Memory needed per entry in sparse and dense indexes.
+static constexpr double const sparse_node_bytes = 16.0;
+static constexpr double const dense_node_bytes = 8.0;
+static constexpr double const sparse_way_bytes = 24.0;
+static constexpr double const dense_way_bytes = 16.0;
+
+std::size_t parse_size(std::string const &size)
+{
+    char *end = nullptr;
+    errno = 0;
+    auto value = std::strtoull(size.c_str(), &end, 10);
+    if (errno != 0 || end == size.c_str()) {
+        throw std::runtime_error{"Invalid size: '" + size + "'"};
+    }
+
+    std::string const suffix{end};
+    if (suffix.empty()) {
+        return value;
+    }
+    if (suffix.size() == 1) {
+        auto const pos = std::string{"KMGT"}.find(*end);
+        if (pos != std::string::npos) {
+            for (std::size_t i = 0; i <= pos; ++i) {
+                if (value > std::numeric_limits<std::size_t>::max() / 1024U) {
+                    throw std::runtime_error{"Size too large: '" + size +
+                                             "'"};
+                }
+                value *= 1024U;
+            }
+            return value;
+        }
+    }
+
+    throw std::runtime_error{"Invalid size: '" + size +
+                             "'. Use suffix 'K', 'M', 'G', or 'T'."};
+}
+
+static bool covers_world(osmium::Box const &bbox) noexcept
+{
+    if (!bbox.valid()) {
+        return true;
+    }
+
+    // Anything larger than a quarter of the world is treated like a planet
+    // file, because the ids in such large extracts are spread over the
+    // whole id space.
+    auto const width = bbox.top_right().lon() - bbox.bottom_left().lon();
+    auto const height = bbox.top_right().lat() - bbox.bottom_left().lat();
+    return width * height >= 360.0 * 180.0 / 4;
+}
+
+static std::string create_tmp_file(std::string const &tmp_dir,
+                                   char const *name,
+                                   index_selection *selection)
+{
+    std::string filename = tmp_dir + "/osm-tags-transform-" + name + "-XXXXXX";
+    int const fd = ::mkstemp(&filename[0]);
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can not create temporary file in '" +
+                                    tmp_dir + "'"};
+    }
+    ::close(fd);
+
+    selection->tmp_files.push_back(filename);
+    return filename;
+}
+
+static double mbytes(double bytes) noexcept { return bytes / 1024 / 1024; }
+
+index_selection select_indexes(std::size_t memory_limit,
+                               osmium::io::File const &input,
+                               std::size_t file_size, osmium::Box const &bbox,
+                               std::string const &tmp_dir,
+                               osmium::VerboseOutput *vout)
+{
+    index_selection selection;
+
+    bool const compressed =
+        input.format() == osmium::io::file_format::pbf ||
+        input.compression() != osmium::io::file_compression::none;
+    double const nodes =
+        static_cast<double>(file_size) /
+        (compressed ? bytes_per_node_compressed : bytes_per_node_uncompressed);
+    double const ways = nodes / nodes_per_way;
+
+    // Dense indexes are cheaper for planet-sized data, sparse ones for
+    // smaller extracts.
+    bool const world = covers_world(bbox);
+    double const node_memory =
+        std::min(nodes * sparse_node_bytes, max_node_id * dense_node_bytes);
+    double const way_memory =
+        world ? std::min(ways * sparse_way_bytes, max_way_id * dense_way_bytes)
+              : ways * sparse_way_bytes;
+    double const limit = static_cast<double>(memory_limit);
+
+    *vout << "Estimated " << static_cast<uint64_t>(nodes) << " nodes and "
+          << static_cast<uint64_t>(ways) << " ways in input file "
+          << (world ? "covering (almost) the whole world" : "(an extract)")
+          << ".\n";
+    *vout << "Estimated memory needed for in-memory indexes: nodes "
+          << static_cast<uint64_t>(mbytes(node_memory)) << "MBytes, ways "
+          << static_cast<uint64_t>(mbytes(way_memory)) << "MBytes (limit "
+          << static_cast<uint64_t>(mbytes(limit)) << "MBytes)\n";
+
+    if (node_memory + way_memory <= limit) {
+        // The flex_mem index switches between sparse and dense storage
+        // automatically.
+        *vout << "Using in-memory indexes.\n";
+        return selection;
+    }
+
+    // Keep way index in memory if possible, it is much smaller and used
+    // for random access.
+    if (way_memory > limit) {
+        selection.way_index =
+            std::string{world ? "dense_file_array," : "sparse_file_array,"} +
+            create_tmp_file(tmp_dir, "ways", &selection);
+    }
+
+    try {
+        selection.node_index =
+            std::string{world ? "dense_file_array," : "sparse_file_array,"} +
+            create_tmp_file(tmp_dir, "nodes", &selection);
+    } catch (...) {
+        for (auto const &tmp_file : selection.tmp_files) {
+            ::unlink(tmp_file.c_str());
+        }
+        throw;
+    }
+
+    *vout << "Using index '" << selection.node_index
+          << "' for node locations and '" << selection.way_index
+          << "' for way bounding boxes.\n";
+
+    return selection;
+}
@@ -0,0 +1,52 @@
+#ifndef INDEX_SELECTION_HPP
+#define INDEX_SELECTION_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include <osmium/io/file.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * The index types to use for node locations and way bounding boxes. Index
+ * names are in the format used by the osmium map factory, for instance
+ * "flex_mem" or "dense_file_array,FILENAME".
+ */
+struct index_selection
+{
+    std::string node_index{"flex_mem"};
+    std::string way_index{"flex_mem"};
+
+    /// Temporary files used for disk-based indexes.
+    std::vector<std::string> tmp_files;
+};
+
+/**
+ * Parse size with optional suffix 'K', 'M', 'G', or 'T' (powers of 1024).
+ * Throws std::runtime_error if the size can not be parsed.
+ */
+std::size_t parse_size(std::string const &size);
+
+/**
+ * Choose index types for node locations and way bounding boxes based on
+ * the memory limit and the estimated number of nodes and ways in the input
+ * file. If the indexes don't fit into memory, disk-based indexes are
+ * used with temporary files in tmp_dir.
+ */
+index_selection select_indexes(std::size_t memory_limit,
+                               osmium::io::File const &input,
+                               std::size_t file_size, osmium::Box const &bbox,
+                               std::string const &tmp_dir,
+                               osmium::VerboseOutput *vout);
+
+#endif // INDEX_SELECTION_HPP
@@ -0,0 +1,232 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "location-indexes.hpp"
+
+#include <osmium/index/map/dense_file_array.hpp>
+#include <osmium/index/map/flex_mem.hpp>
+#include <osmium/index/map/sparse_file_array.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+
+/**
+ * Create a file-based index if the name is "dense_file_array,FILENAME" or
+ * "sparse_file_array,FILENAME". The file is opened here instead of in the
+ * osmium map factory, because the osmium maps don't close it. The file
+ * descriptor is returned in fd, the caller has to close it after the
+ * index has been destroyed. Returns nullptr for any other index name.
+ */
+template <typename TValue>
+static std::unique_ptr<
+    osmium::index::map::Map<osmium::unsigned_object_id_type, TValue>>
+create_file_index(std::string const &name, char const *what, int *fd)
+{
+    using id_type = osmium::unsigned_object_id_type;
+
+    auto const pos = name.find(',');
+    if (pos == std::string::npos) {
+        return nullptr;
+    }
+
+    std::string const type = name.substr(0, pos);
+    std::string const filename = name.substr(pos + 1);
+    if (type != "dense_file_array" && type != "sparse_file_array") {
+        return nullptr;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    *fd = ::open(filename.c_str(), O_CREAT | O_RDWR, 0644);
+    if (*fd < 0) {
+        throw std::system_error{errno, std::system_category(),
+                                std::string{"Can not open "} + what +
+                                    " index file '" + filename + "'"};
+    }
+
+    if (type == "dense_file_array") {
+        return std::make_unique<
+            osmium::index::map::DenseFileArray<id_type, TValue>>(*fd);
+    }
+    return std::make_unique<
+        osmium::index::map::SparseFileArray<id_type, TValue>>(*fd);
+}
+
+LocationIndexes::LocationIndexes(std::string const &node_index_name,
+                                 std::string const &way_index_name)
+{
+    m_node_index = create_file_index<osmium::Location>(
+        node_index_name, "node", &m_node_index_fd);
+    if (!m_node_index) {
+        const auto &map_factory =
+            osmium::index::MapFactory<osmium::unsigned_object_id_type,
+                                      osmium::Location>::instance();
+        m_node_index = map_factory.create_map(node_index_name);
+    }
+
+    // The osmium map factory only knows about node location indexes, so
+    // the index types we support for ways are created here.
+    try {
+        m_way_index = create_file_index<osmium::Box>(way_index_name, "way",
+                                                     &m_way_index_fd);
+        if (!m_way_index && way_index_name != "flex_mem") {
+            throw std::runtime_error{"Unknown index type for ways: '" +
+                                     way_index_name + "'"};
+        }
+    } catch (...) {
+        // The destructor is not called if the constructor throws.
+        m_node_index.reset();
+        if (m_node_index_fd >= 0) {
+            ::close(m_node_index_fd);
+        }
+        throw;
+    }
+
+    if (!m_way_index) {
+        m_way_index = std::make_unique<
+            osmium::index::map::FlexMem<osmium::unsigned_object_id_type,
+                                        osmium::Box>>();
+    }
+}
+
+LocationIndexes::~LocationIndexes() noexcept
+{
+    // The indexes must be gone before their files are closed.
+    m_node_index.reset();
+    m_way_index.reset();
+    if (m_node_index_fd >= 0) {
+        ::close(m_node_index_fd);
+    }
+    if (m_way_index_fd >= 0) {
+        ::close(m_way_index_fd);
+    }
+}
+
+void LocationIndexes::add_ways(osmium::memory::Buffer const &buffer)
+{
+    if (m_complete) {
+        return;
+    }
+
+    prepare_ways();
+
+    way_box_batch batch;
+    calculate_way_boxes(buffer, &batch);
+
+    auto box = batch.boxes.cbegin();
+    for (auto const &way : buffer.select<osmium::Way>()) {
+        if (box->valid()) {
+            add_way(way.positive_id(), *box);
+        }
+        ++box;
+    }
+}
+
+void LocationIndexes::prepare_ways()
+{
+    if (m_must_sort_node_index) {
+        m_node_index->sort();
+        m_must_sort_node_index = false;
+    }
+}
+
+void LocationIndexes::prepare_relations()
+{
+    prepare_ways();
+    if (m_must_sort_way_index) {
+        m_way_index->sort();
+        m_must_sort_way_index = false;
+    }
+}
+
+osmium::Box LocationIndexes::way_box(osmium::Way const &way) const
+{
+    osmium::Box box;
+
+    for (auto const &nr : way.nodes()) {
+        auto const location = m_node_index->get_noexcept(nr.positive_ref());
+        if (location) {
+            box.extend(location);
+        }
+    }
+
+    return box;
+}
+
+void LocationIndexes::calculate_way_boxes(osmium::memory::Buffer const &buffer,
+                                          way_box_batch *batch) const
+{
+    auto &ids = batch->node_ids;
+    ids.clear();
+    batch->locations.clear();
+    batch->boxes.clear();
+
+    for (auto const &way : buffer.select<osmium::Way>()) {
+        for (auto const &nr : way.nodes()) {
+            ids.push_back(nr.positive_ref());
+        }
+    }
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    batch->locations.reserve(ids.size());
+    for (auto const id : ids) {
+        batch->locations.push_back(m_node_index->get_noexcept(id));
+    }
+
+    for (auto const &way : buffer.select<osmium::Way>()) {
+        osmium::Box box;
+        for (auto const &nr : way.nodes()) {
+            auto const it =
+                std::lower_bound(ids.cbegin(), ids.cend(), nr.positive_ref());
+            auto const &location = batch->locations[static_cast<std::size_t>(
+                std::distance(ids.cbegin(), it))];
+            if (location) {
+                box.extend(location);
+            }
+        }
+        batch->boxes.push_back(box);
+    }
+}
+
+osmium::Box LocationIndexes::relation_box(osmium::Relation const &relation) const
+{
+    osmium::Box box;
+
+    for (auto const &member : relation.members()) {
+        if (member.type() == osmium::item_type::node) {
+            auto const location =
+                m_node_index->get_noexcept(member.positive_ref());
+            if (location) {
+                box.extend(location);
+            }
+        } else if (member.type() == osmium::item_type::way) {
+            auto const wbox = m_way_index->get_noexcept(member.positive_ref());
+            if (wbox.valid()) {
+                box.extend(wbox);
+            }
+        }
+    }
+
+    return box;
+}
+
+void LocationIndexes::output_memory_used(osmium::VerboseOutput *vout) const
+{
+    constexpr auto const mbytes = 1024UL * 1024UL;
+
+    *vout << "Memory used for node locations: "
+          << (m_node_index->used_memory() / mbytes) << "MBytes\n";
+    *vout << "Memory used for way locations: "
+          << (m_way_index->used_memory() / mbytes) << "MBytes\n";
+}
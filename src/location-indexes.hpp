@@ -0,0 +1,128 @@
+#ifndef LOCATION_INDEXES_HPP
+#define LOCATION_INDEXES_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include <osmium/index/map.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Way bounding boxes collected while processing ways in parallel.
+using way_boxes_type =
+    std::vector<std::pair<osmium::unsigned_object_id_type, osmium::Box>>;
+
+/**
+ * Bounding boxes for all ways in a buffer calculated with
+ * LocationIndexes::calculate_way_boxes(). Also holds the memory needed
+ * while calculating them so that it can be reused for the next buffer.
+ */
+struct way_box_batch
+{
+    std::vector<osmium::unsigned_object_id_type> node_ids;
+    std::vector<osmium::Location> locations;
+
+    /// The bounding boxes in the order of the ways in the buffer.
+    std::vector<osmium::Box> boxes;
+}; // struct way_box_batch
+
+/**
+ * The indexes for node locations and way bounding boxes needed for
+ * geometry processing. They can be shared between several handlers.
+ *
+ * Nodes and ways have to be added in order (all nodes before all ways).
+ * The indexes are sorted lazily when prepare_ways() or prepare_relations()
+ * is called the first time. After that the node index (or the way index,
+ * respectively) is only read, so lookups can be done from several threads
+ * at the same time.
+ */
+class LocationIndexes
+{
+public:
+    LocationIndexes(std::string const &node_index_name,
+                    std::string const &way_index_name);
+
+    LocationIndexes(LocationIndexes const &) = delete;
+    LocationIndexes &operator=(LocationIndexes const &) = delete;
+
+    LocationIndexes(LocationIndexes &&) = delete;
+    LocationIndexes &operator=(LocationIndexes &&) = delete;
+
+    ~LocationIndexes() noexcept;
+
+    void add_node(osmium::Node const &node)
+    {
+        if (!m_complete) {
+            m_node_index->set(node.positive_id(), node.location());
+        }
+    }
+
+    void add_way(osmium::unsigned_object_id_type id, osmium::Box const &box)
+    {
+        if (!m_complete) {
+            m_way_index->set(id, box);
+        }
+    }
+
+    /**
+     * Mark indexes as complete after all nodes and ways have been added
+     * in an earlier pass over the input. Adding to them is ignored after
+     * this.
+     */
+    void set_complete() noexcept { m_complete = true; }
+
+    /// Calculate the bounding boxes of all ways in the buffer and add them.
+    void add_ways(osmium::memory::Buffer const &buffer);
+
+    /// Must be called before way bounding boxes are calculated.
+    void prepare_ways();
+
+    /// Must be called before relation bounding boxes are calculated.
+    void prepare_relations();
+
+    osmium::Box way_box(osmium::Way const &way) const;
+
+    /**
+     * Calculate the bounding boxes of all ways in the buffer. Instead of
+     * looking up the node locations way by way in random order, all node
+     * ids referenced from the ways are sorted and deduplicated first and
+     * their locations are looked up in one sweep through the index. This
+     * is much more cache-friendly, especially for file-based indexes.
+     */
+    void calculate_way_boxes(osmium::memory::Buffer const &buffer,
+                             way_box_batch *batch) const;
+    osmium::Box relation_box(osmium::Relation const &relation) const;
+
+    void output_memory_used(osmium::VerboseOutput *vout) const;
+
+private:
+    using node_index_type =
+        osmium::index::map::Map<osmium::unsigned_object_id_type,
+                                osmium::Location>;
+    using way_index_type =
+        osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Box>;
+
+    std::unique_ptr<node_index_type> m_node_index;
+    std::unique_ptr<way_index_type> m_way_index;
+
+    // File descriptors of file-based indexes (-1 if not used).
+    int m_node_index_fd = -1;
+    int m_way_index_fd = -1;
+    bool m_must_sort_node_index = true;
+    bool m_must_sort_way_index = true;
+    bool m_complete = false;
+
+}; // class LocationIndexes
+
+#endif // LOCATION_INDEXES_HPP
@@ -0,0 +1,266 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "lua-cache.hpp"
+
+extern "C"
+{
+#include <lauxlib.h>
+#ifdef HAVE_LUAJIT
+#include <luajit.h>
+#endif
+}
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <unistd.h>
+#include <utility>
+
+// Bytecode is only compatible between identical Lua versions.
+#ifdef HAVE_LUAJIT
+static char const *const lua_version_key = LUAJIT_VERSION;
+#else
+static char const *const lua_version_key = LUA_RELEASE;
+#endif
+
+static bool read_file(std::string const &filename, std::string *content)
+{
+    std::ifstream in{filename, std::ios::binary};
+    if (!in) {
+        return false;
+    }
+    content->assign(std::istreambuf_iterator<char>{in},
+                    std::istreambuf_iterator<char>{});
+    return !in.bad();
+}
+
+static int dump_writer(lua_State * /*lua_state*/, void const *data,
+                       std::size_t size, void *out)
+{
+    static_cast<std::string *>(out)->append(static_cast<char const *>(data),
+                                            size);
+    return 0;
+}
+
+LuaCache::LuaCache(std::string directory) : m_directory(std::move(directory))
+{}
+
+std::string LuaCache::cache_filename(std::string const &key) const
+{
+    std::ostringstream name;
+    name << m_directory << '/' << std::hex << std::hash<std::string>{}(key)
+         << ".luac";
+    return name.str();
+}
+
+/**
+ * Load compiled code for the key from the cache or compile the code and
+ * write the result to the cache. Cache files start with the key on a line
+ * by itself which is checked on reading, so that hash collisions or stale
+ * files are detected.
+ */
+int LuaCache::load(lua_State *lua_state, std::string const &key,
+                   char const *chunkname, char const *code, std::size_t size)
+{
+    std::string const filename = cache_filename(key);
+    std::string const header = key + '\n';
+
+    std::string cached;
+    if (read_file(filename, &cached) && cached.size() > header.size() &&
+        cached.compare(0, header.size(), header) == 0) {
+        if (luaL_loadbuffer(lua_state, cached.data() + header.size(),
+                            cached.size() - header.size(), chunkname) == 0) {
+            ++m_hits;
+            return 0;
+        }
+        lua_pop(lua_state, 1); // error message
+    }
+
+    ++m_misses;
+    int const status = luaL_loadbuffer(lua_state, code, size, chunkname);
+    if (status != 0) {
+        return status;
+    }
+
+    std::string bytecode{header};
+#if LUA_VERSION_NUM >= 503
+    int const dump_status = lua_dump(lua_state, dump_writer, &bytecode, 0);
+#else
+    int const dump_status = lua_dump(lua_state, dump_writer, &bytecode);
+#endif
+
+    // Failing to write the cache is not an error, we'll just compile the
+    // code again next time. Write to a temporary file first, so that no
+    // other process sees an incomplete file. Its name is unique for each
+    // cache, because other caches (in this or other processes) might be
+    // writing the same file at the same time.
+    if (dump_status == 0) {
+        std::ostringstream tmp_name;
+        tmp_name << filename << '.' << ::getpid() << '-'
+                 << static_cast<void const *>(this) << ".tmp";
+        std::string const tmp_filename = tmp_name.str();
+        std::ofstream out{tmp_filename, std::ios::binary};
+        out.write(bytecode.data(), static_cast<std::streamsize>(bytecode.size()));
+        out.close();
+        if (out) {
+            std::rename(tmp_filename.c_str(), filename.c_str());
+        } else {
+            std::remove(tmp_filename.c_str());
+        }
+    }
+
+    return 0;
+}
+
+int LuaCache::load_file(lua_State *lua_state, std::string const &filename)
+{
+    if (!enabled()) {
+        return luaL_loadfile(lua_state, filename.c_str());
+    }
+
+    std::string code;
+    if (!read_file(filename, &code)) {
+        // Let Lua generate the error message.
+        return luaL_loadfile(lua_state, filename.c_str());
+    }
+
+    // The file has to be read anyway, so a hash of its contents is used
+    // to find out whether it has changed. Modification times are not
+    // precise enough for files changed quickly after each other. The path
+    // is used as given, so different relative paths to the same file can
+    // result in different cache files.
+    std::ostringstream key;
+    key << lua_version_key << '\t' << filename << '\t' << code.size()
+        << '\t' << std::hex << std::hash<std::string>{}(code);
+
+    std::string const chunkname = '@' + filename;
+    return load(lua_state, key.str(), chunkname.c_str(), code.data(),
+                code.size());
+}
+
+int LuaCache::load_string(lua_State *lua_state, char const *code,
+                          char const *chunkname)
+{
+    std::size_t const size = std::strlen(code);
+
+    if (!enabled()) {
+        return luaL_loadbuffer(lua_state, code, size, chunkname);
+    }
+
+    // Embedded code can only change with the program version, but use a
+    // hash of the code to be safe.
+    std::ostringstream key;
+    key << lua_version_key << '\t' << chunkname << '\t'
+        << PROJECT_VERSION << '\t' << std::hex
+        << std::hash<std::string>{}(std::string{code, size});
+
+    return load(lua_state, key.str(), chunkname, code, size);
+}
+
+/**
+ * Find a Lua module in package.path like the standard Lua searcher does.
+ * Returns an empty string if it can't be found.
+ */
+static std::string find_module(lua_State *lua_state, char const *name)
+{
+    lua_getglobal(lua_state, "package");
+    lua_getfield(lua_state, -1, "path");
+    char const *path = lua_tostring(lua_state, -1);
+    std::string const templates{path ? path : ""};
+    lua_pop(lua_state, 2);
+
+    std::string module_path{name};
+    for (auto &c : module_path) {
+        if (c == '.') {
+            c = '/';
+        }
+    }
+
+    std::string::size_type begin = 0;
+    while (begin <= templates.size()) {
+        auto end = templates.find(';', begin);
+        if (end == std::string::npos) {
+            end = templates.size();
+        }
+
+        std::string filename;
+        for (auto i = begin; i < end; ++i) {
+            if (templates[i] == '?') {
+                filename += module_path;
+            } else {
+                filename += templates[i];
+            }
+        }
+
+        if (!filename.empty()) {
+            std::FILE *file = std::fopen(filename.c_str(), "r");
+            if (file) {
+                std::fclose(file);
+                return filename;
+            }
+        }
+
+        begin = end + 1;
+    }
+
+    return {};
+}
+
+static int cache_searcher(lua_State *lua_state)
+{
+    auto *cache =
+        static_cast<LuaCache *>(lua_touserdata(lua_state, lua_upvalueindex(1)));
+    char const *const name = luaL_checkstring(lua_state, 1);
+
+    std::string const filename = find_module(lua_state, name);
+    if (filename.empty()) {
+        // Not found, the standard searchers will report this.
+        lua_pushliteral(lua_state, "");
+        return 1;
+    }
+
+    if (cache->load_file(lua_state, filename) != 0) {
+        return lua_error(lua_state);
+    }
+    lua_pushstring(lua_state, filename.c_str());
+    return 2;
+}
+
+void LuaCache::install_searcher(lua_State *lua_state)
+{
+    if (!enabled()) {
+        return;
+    }
+
+    lua_getglobal(lua_state, "package");
+#if LUA_VERSION_NUM >= 502
+    lua_getfield(lua_state, -1, "searchers");
+#else
+    lua_getfield(lua_state, -1, "loaders");
+#endif
+
+    // Insert our searcher at position 2, after the preload searcher.
+#if LUA_VERSION_NUM >= 502
+    int const size = static_cast<int>(lua_rawlen(lua_state, -1));
+#else
+    int const size = static_cast<int>(lua_objlen(lua_state, -1));
+#endif
+    for (int i = size; i >= 2; --i) {
+        lua_rawgeti(lua_state, -1, i);
+        lua_rawseti(lua_state, -2, i + 1);
+    }
+    lua_pushlightuserdata(lua_state, this);
+    lua_pushcclosure(lua_state, cache_searcher, 1);
+    lua_rawseti(lua_state, -2, 2);
+
+    lua_pop(lua_state, 2); // package.searchers and package
+}
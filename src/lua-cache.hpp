@@ -0,0 +1,71 @@
+#ifndef LUA_CACHE_HPP
+#define LUA_CACHE_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+extern "C"
+{
+#include <lua.h>
+}
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Cache for compiled Lua code. Precompiled bytecode is stored in files in
+ * a cache directory, one file per Lua file (or embedded Lua code). Cache
+ * files are only used if the path, size, and a hash of the contents of the
+ * Lua file, and the Lua version are the same as when they were written.
+ *
+ * If the cache directory is empty, the cache is disabled and all code is
+ * loaded from source.
+ */
+class LuaCache
+{
+public:
+    explicit LuaCache(std::string directory);
+
+    bool enabled() const noexcept { return !m_directory.empty(); }
+
+    /**
+     * Load Lua file and push the compiled chunk onto the stack. Returns
+     * the status like luaL_loadfile(), on error the message is on the
+     * stack instead of the chunk.
+     */
+    int load_file(lua_State *lua_state, std::string const &filename);
+
+    /**
+     * Load Lua code from a string and push the compiled chunk onto the
+     * stack. Returns the status like luaL_loadbuffer().
+     */
+    int load_string(lua_State *lua_state, char const *code,
+                    char const *chunkname);
+
+    /**
+     * Add a searcher for require() which loads Lua modules through this
+     * cache. It is used before the standard searcher for Lua files.
+     */
+    void install_searcher(lua_State *lua_state);
+
+    uint64_t hits() const noexcept { return m_hits; }
+    uint64_t misses() const noexcept { return m_misses; }
+
+private:
+    int load(lua_State *lua_state, std::string const &key,
+             char const *chunkname, char const *code, std::size_t size);
+
+    std::string cache_filename(std::string const &key) const;
+
+    std::string m_directory;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+
+}; // class LuaCache
+
+#endif // LUA_CACHE_HPP
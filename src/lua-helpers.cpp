@@ -0,0 +1,206 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "lua-helpers.hpp"
+#include "lua-utils.hpp"
+
+extern "C"
+{
+#include <lauxlib.h>
+}
+
+#include <cstddef>
+#include <cstring>
+
+static int has_prefix(lua_State *lua_state)
+{
+    if (lua_isnil(lua_state, 1)) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+
+    std::size_t str_len = 0;
+    std::size_t prefix_len = 0;
+    char const *const str = luaL_checklstring(lua_state, 1, &str_len);
+    char const *const prefix = luaL_checklstring(lua_state, 2, &prefix_len);
+
+    lua_pushboolean(lua_state, prefix_len <= str_len &&
+                                   std::memcmp(str, prefix, prefix_len) == 0);
+    return 1;
+}
+
+static int has_suffix(lua_State *lua_state)
+{
+    if (lua_isnil(lua_state, 1)) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+
+    std::size_t str_len = 0;
+    std::size_t suffix_len = 0;
+    char const *const str = luaL_checklstring(lua_state, 1, &str_len);
+    char const *const suffix = luaL_checklstring(lua_state, 2, &suffix_len);
+
+    lua_pushboolean(lua_state,
+                    suffix_len <= str_len &&
+                        std::memcmp(str + str_len - suffix_len, suffix,
+                                    suffix_len) == 0);
+    return 1;
+}
+
+/**
+ * Match str against pattern. In the pattern '*' matches any number of
+ * characters and '?' matches exactly one character.
+ */
+static bool glob_match(char const *str, std::size_t str_len,
+                       char const *pattern, std::size_t pattern_len) noexcept
+{
+    std::size_t s = 0;
+    std::size_t p = 0;
+
+    // Position in pattern after the last '*' seen and position in str
+    // where the part matched by that '*' ends.
+    bool have_star = false;
+    std::size_t star_p = 0;
+    std::size_t star_s = 0;
+
+    while (s < str_len) {
+        if (p < pattern_len && pattern[p] == '*') {
+            have_star = true;
+            star_p = ++p;
+            star_s = s;
+        } else if (p < pattern_len &&
+                   (pattern[p] == '?' || pattern[p] == str[s])) {
+            ++s;
+            ++p;
+        } else if (have_star) {
+            // Let the last '*' match one more character and try again.
+            p = star_p;
+            s = ++star_s;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern_len && pattern[p] == '*') {
+        ++p;
+    }
+
+    return p == pattern_len;
+}
+
+/**
+ * Call match(key) for all string keys in the table at stack index 1 and
+ * return a new array table with all keys for which it returns true.
+ */
+template <typename TMatch>
+static int collect_keys(lua_State *lua_state, TMatch &&match)
+{
+    luaL_checktype(lua_state, 1, LUA_TTABLE);
+
+    lua_newtable(lua_state);
+    int const result = lua_gettop(lua_state);
+    int n = 0;
+
+    lua_pushnil(lua_state);
+    while (lua_next(lua_state, 1) != 0) {
+        if (lua_type(lua_state, -2) == LUA_TSTRING) {
+            std::size_t len = 0;
+            char const *const key = lua_tolstring(lua_state, -2, &len);
+            if (match(key, len)) {
+                lua_pushvalue(lua_state, -2);
+                lua_rawseti(lua_state, result, ++n);
+            }
+        }
+        lua_pop(lua_state, 1); // value pushed by lua_next()
+    }
+
+    return 1;
+}
+
+static int keys_with_prefix(lua_State *lua_state)
+{
+    std::size_t prefix_len = 0;
+    char const *const prefix = luaL_checklstring(lua_state, 2, &prefix_len);
+
+    return collect_keys(lua_state, [&](char const *key, std::size_t len) {
+        return prefix_len <= len && std::memcmp(key, prefix, prefix_len) == 0;
+    });
+}
+
+static int match_keys(lua_State *lua_state)
+{
+    std::size_t pattern_len = 0;
+    char const *const pattern = luaL_checklstring(lua_state, 2, &pattern_len);
+
+    return collect_keys(lua_state, [&](char const *key, std::size_t len) {
+        return glob_match(key, len, pattern, pattern_len);
+    });
+}
+
+static bool is_space(char c) noexcept { return c == ' ' || c == '\t'; }
+
+static int split_list(lua_State *lua_state)
+{
+    if (lua_isnil(lua_state, 1)) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+
+    std::size_t len = 0;
+    char const *const str = luaL_checklstring(lua_state, 1, &len);
+    char const *const separator = luaL_optstring(lua_state, 2, ";");
+    if (std::strlen(separator) != 1) {
+        return luaL_error(lua_state,
+                          "Separator for split_list() must be one character");
+    }
+
+    lua_newtable(lua_state);
+    int n = 0;
+
+    char const *const end = str + len;
+    char const *begin = str;
+    for (;;) {
+        char const *sep = static_cast<char const *>(
+            std::memchr(begin, *separator, static_cast<std::size_t>(end - begin)));
+        if (!sep) {
+            sep = end;
+        }
+
+        // Remove leading and trailing white space, ignore empty parts.
+        char const *first = begin;
+        char const *last = sep;
+        while (first < last && is_space(*first)) {
+            ++first;
+        }
+        while (last > first && is_space(*(last - 1))) {
+            --last;
+        }
+        if (first < last) {
+            lua_pushlstring(lua_state, first,
+                            static_cast<std::size_t>(last - first));
+            lua_rawseti(lua_state, -2, ++n);
+        }
+
+        if (sep == end) {
+            break;
+        }
+        begin = sep + 1;
+    }
+
+    return 1;
+}
+
+void luaX_add_helper_functions(lua_State *lua_state)
+{
+    luaX_add_table_func(lua_state, "has_prefix", has_prefix);
+    luaX_add_table_func(lua_state, "has_suffix", has_suffix);
+    luaX_add_table_func(lua_state, "keys_with_prefix", keys_with_prefix);
+    luaX_add_table_func(lua_state, "match_keys", match_keys);
+    luaX_add_table_func(lua_state, "split_list", split_list);
+}
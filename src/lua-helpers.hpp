@@ -0,0 +1,35 @@
+#ifndef LUA_HELPERS_HPP
+#define LUA_HELPERS_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+/**
+ * Helper functions available in Lua in the "ott" namespace. They are
+ * implemented in C++ because they are called very often, for instance
+ * for every key of every object. They work directly on the Lua strings
+ * without creating substrings.
+ */
+
+extern "C"
+{
+#include <lua.h>
+}
+
+/**
+ * Add the helper functions to the table on top of the Lua stack:
+ *
+ * * has_prefix(str, prefix)
+ * * has_suffix(str, suffix)
+ * * keys_with_prefix(tags, prefix)
+ * * match_keys(tags, pattern)
+ * * split_list(str, separator = ';')
+ */
+void luaX_add_helper_functions(lua_State *lua_state);
+
+#endif // LUA_HELPERS_HPP
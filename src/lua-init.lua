@@ -2,17 +2,29 @@
 --  This Lua initialization code will be compiled into osm-tags-transform.
 --
 
-function ott.has_prefix(str, prefix)
-    if str == nil then
-        return nil
-    end
-    return str:sub(1, prefix:len()) == prefix
-end
+-- Functions on OSM objects implemented in C++. The global is removed again
+-- after this script has run.
+local get_tags = object_functions.get_tags
+
+local object_methods = {
+    get_tag = object_functions.get_tag,
+    set_tag = object_functions.set_tag,
+    delete_tag = object_functions.delete_tag
+}
 
 -- This will be the metatable for the OSM objects given to the process callback
--- functions.
-local inner_metatable = {
-    __index = function(table, key)
+-- functions. The tags table is only created when it is first accessed.
+object_metatable = {
+    __index = function(object, key)
+        if key == 'tags' then
+            local tags = get_tags(object)
+            rawset(object, 'tags', tags)
+            return tags
+        end
+        local method = object_methods[key]
+        if method then
+            return method
+        end
         if key == 'version' or key == 'timestamp' or
            key == 'changeset' or key == 'uid' or key == 'user' or key == 'bbox' then
             return nil
@@ -21,9 +33,3 @@ local inner_metatable = {
     end
 }
 
-object_metatable = {
-    __index = {}
-}
-
-setmetatable(object_metatable.__index, inner_metatable)
-
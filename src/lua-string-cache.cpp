@@ -0,0 +1,64 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "lua-string-cache.hpp"
+
+extern "C"
+{
+#include <lauxlib.h>
+}
+
+#include <cstring>
+
+void LuaStringCache::push(lua_State *lua_state, char const *str)
+{
+    // FNV-1a hash stopping at the end of the string or max_length + 1
+    // characters, whichever comes first.
+    uint32_t hash = 2166136261U;
+    std::size_t length = 0;
+    while (str[length] != '\0' && length <= max_length) {
+        hash = (hash ^ static_cast<unsigned char>(str[length])) * 16777619U;
+        ++length;
+    }
+
+    if (length > max_length) {
+        lua_pushstring(lua_state, str);
+        return;
+    }
+
+    auto &s = m_slots[hash & (num_slots - 1)];
+    if (s.str.size() == length && std::memcmp(s.str.data(), str, length) == 0 &&
+        s.ref != LUA_NOREF) {
+        ++m_hits;
+        if (s.count < max_count) {
+            ++s.count;
+        }
+        lua_rawgeti(lua_state, LUA_REGISTRYINDEX, s.ref);
+        return;
+    }
+
+    ++m_misses;
+    lua_pushlstring(lua_state, str, length);
+
+    if (s.count > 0) {
+        --s.count;
+        if (s.count > 0) {
+            return;
+        }
+    }
+
+    // Replace string in this slot.
+    lua_pushvalue(lua_state, -1);
+    if (s.ref == LUA_NOREF) {
+        s.ref = luaL_ref(lua_state, LUA_REGISTRYINDEX);
+    } else {
+        lua_rawseti(lua_state, LUA_REGISTRYINDEX, s.ref);
+    }
+    s.str.assign(str, length);
+    s.count = 1;
+}
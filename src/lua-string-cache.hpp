@@ -0,0 +1,64 @@
+#ifndef LUA_STRING_CACHE_HPP
+#define LUA_STRING_CACHE_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+extern "C"
+{
+#include <lua.h>
+}
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Cache for short strings pushed onto the Lua stack again and again, like
+ * common tag keys and values. The Lua strings are kept in the registry, so
+ * pushing a cached string is a table lookup and Lua doesn't have to hash,
+ * intern, and (after they have been garbage collected) allocate them again.
+ *
+ * This is a direct-mapped cache. Each slot has a small counter which is
+ * incremented on hits and decremented on misses; a slot is only replaced
+ * when its counter drops to zero, so that rare strings like names don't
+ * push out the frequent ones.
+ */
+class LuaStringCache
+{
+public:
+    /// Push string onto the Lua stack, from the cache if possible.
+    void push(lua_State *lua_state, char const *str);
+
+    uint64_t hits() const noexcept { return m_hits; }
+    uint64_t misses() const noexcept { return m_misses; }
+
+private:
+    // Longer strings are not cached (this is the limit for "short" strings
+    // in Lua 5.4).
+    static constexpr std::size_t const max_length = 40;
+
+    static constexpr std::size_t const num_slots = 8192;
+
+    static constexpr uint32_t const max_count = 8;
+
+    struct slot
+    {
+        std::string str;
+        int ref = LUA_NOREF;
+        uint32_t count = 0;
+    }; // struct slot
+
+    std::vector<slot> m_slots{num_slots};
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+
+}; // class LuaStringCache
+
+#endif // LUA_STRING_CACHE_HPP
@@ -6,7 +6,15 @@
  * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
  */
 
+#include "change-writer.hpp"
 #include "handler.hpp"
+#include "index-selection.hpp"
+#include "location-indexes.hpp"
+#include "output-buffers.hpp"
+#include "progress.hpp"
+#include "slow-objects.hpp"
+#include "sorted-check.hpp"
+#include "worker-pool.hpp"
 
 #include <osmium/index/map/all.hpp>
 #include <osmium/index/node_locations_map.hpp>
@@ -16,21 +24,40 @@
 #include <osmium/io/writer.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm.hpp>
+#include <osmium/util/file.hpp>
 #include <osmium/util/memory.hpp>
 #include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include <protozero/pbf_reader.hpp>
 
 #include <array>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <future>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
 
 void show_help()
 {
     std::cout << "Usage: osm-tags-transform [OPTIONS] INPUT_FILE\n\n";
     std::cout << "Options:\n";
     std::cout << "  -c, --config-file=CONFIG.lua  Set config file\n";
+    std::cout << "  -C, --changes=OSC_FILE        Write changed and deleted objects "
+                 "into OSC_FILE\n";
     std::cout << "  -f, --output-format=FORMAT    Set output file format\n";
     std::cout << "  -g, --geom-proc=TYPE          Geometry processing ('none' "
                  "(default) or 'bbox')\n";
@@ -38,8 +65,24 @@ void show_help()
     std::cout << "  -i, --index-type=INDEX        Set index type (default: "
                  "'flex_mem')\n";
     std::cout << "  -I, --show-index-types        Show available index types\n";
+    std::cout << "  -j, --threads=NUM             Number of threads for Lua "
+                 "processing (default: 1)\n";
+    std::cout << "  -L, --lua-cache=DIR           Cache compiled Lua code in "
+                 "directory DIR\n";
+    std::cout << "  -m, --memory-limit=SIZE       Choose index types at "
+                 "startup to fit into SIZE (like '8G')\n";
     std::cout << "  -o, --output=OUTPUT_FILE      Set output file name\n";
     std::cout << "  -O, --overwrite               Allow an existing output file to be overwritten.\n";
+    std::cout << "  -p, --progress                Show progress on stderr\n";
+    std::cout << "  -P, --progress-file=FILE      Write progress in JSON format "
+                 "to FILE\n";
+    std::cout << "  -r, --keep-referenced=MODE    Keep dropped objects referenced "
+                 "from ways or relations ('none' (default), 'copy', or "
+                 "'untagged')\n";
+    std::cout << "  -R, --resume                  Resume an interrupted run writing "
+                 "a PBF file\n";
+    std::cout << "  -t, --trace-slow=N            Show the N objects with the "
+                 "slowest Lua processing\n";
     std::cout << "  -u, --untagged=MODE           What to do with untagged objects "
                  "('drop', 'copy' (default), or 'process')\n";
     std::cout << "  -v, --verbose                 Enable verbose mode\n";
@@ -106,19 +149,179 @@ static untagged_mode check_untagged(std::string const &mode)
                              "'. Use 'drop', 'copy', or 'process'."};
 }
 
+static keep_referenced_mode check_keep_referenced(std::string const &mode)
+{
+    if (mode == "none") {
+        return keep_referenced_mode::none;
+    }
+    if (mode == "copy") {
+        return keep_referenced_mode::copy;
+    }
+    if (mode == "untagged") {
+        return keep_referenced_mode::untagged;
+    }
+
+    throw std::runtime_error{"Unknown mode for -r, --keep-referenced: '" +
+                             mode + "'. Use 'none', 'copy', or 'untagged'."};
+}
+
+static std::size_t check_threads(std::string const &arg)
+{
+    char *end = nullptr;
+    auto const num = std::strtoul(arg.c_str(), &end, 10);
+    if (arg.empty() || *end != '\0' || num == 0 || num > 256) {
+        throw std::runtime_error{"Invalid number for -j, --threads: '" + arg +
+                                 "'. Use number between 1 and 256."};
+    }
+    return num;
+}
+
+static std::size_t check_trace_slow(std::string const &arg)
+{
+    char *end = nullptr;
+    auto const num = std::strtoul(arg.c_str(), &end, 10);
+    if (arg.empty() || *end != '\0' || num == 0 || num > 100000) {
+        throw std::runtime_error{"Invalid number for -t, --trace-slow: '" +
+                                 arg + "'. Use number between 1 and 100000."};
+    }
+    return num;
+}
+
+static void remove_files(std::vector<std::string> const &filenames)
+{
+    for (auto const &filename : filenames) {
+        ::unlink(filename.c_str());
+    }
+}
+
+// Limits from the PBF format specification.
+static constexpr uint32_t const max_pbf_blob_header_size = 64UL * 1024UL;
+static constexpr int32_t const max_pbf_blob_size = 32L * 1024L * 1024L;
+
+/**
+ * Get the size of the PBF file up to the end of the last complete block.
+ * Only the framing of the blocks is checked here, not their content.
+ */
+static std::size_t complete_pbf_size(std::string const &filename)
+{
+    std::ifstream in{filename, std::ios::binary};
+    if (!in) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can not open '" + filename + "'"};
+    }
+
+    std::size_t const file_size = osmium::file_size(filename);
+    std::size_t size = 0;
+    while (true) {
+        std::array<unsigned char, 4> size_bytes{};
+        in.read(reinterpret_cast<char *>(size_bytes.data()),
+                size_bytes.size());
+        if (in.gcount() != static_cast<std::streamsize>(size_bytes.size())) {
+            return size;
+        }
+        uint32_t const header_size =
+            (static_cast<uint32_t>(size_bytes[0]) << 24U) |
+            (static_cast<uint32_t>(size_bytes[1]) << 16U) |
+            (static_cast<uint32_t>(size_bytes[2]) << 8U) |
+            static_cast<uint32_t>(size_bytes[3]);
+        if (header_size > max_pbf_blob_header_size) {
+            throw std::runtime_error{"Invalid block in '" + filename +
+                                     "': Not a PBF file?"};
+        }
+
+        std::string header(header_size, '\0');
+        in.read(&header[0], header_size);
+        if (in.gcount() != static_cast<std::streamsize>(header_size)) {
+            return size;
+        }
+
+        int32_t data_size = -1;
+        protozero::pbf_reader message{header};
+        while (message.next()) {
+            // Field 3 of the BlobHeader is the size of the Blob.
+            if (message.tag() == 3 &&
+                message.wire_type() == protozero::pbf_wire_type::varint) {
+                data_size = message.get_int32();
+            } else {
+                message.skip();
+            }
+        }
+        if (data_size < 0 || data_size > max_pbf_blob_size) {
+            throw std::runtime_error{"Invalid block in '" + filename +
+                                     "': Not a PBF file?"};
+        }
+
+        std::size_t const block_end = size + size_bytes.size() + header_size +
+                                      static_cast<std::size_t>(data_size);
+        if (block_end > file_size) {
+            return size;
+        }
+        size = block_end;
+        in.seekg(static_cast<std::streamoff>(size));
+    }
+}
+
+/**
+ * Copy all objects from the PBF output file of an interrupted earlier run
+ * into the writer. The last block of the file might be incomplete, because
+ * the program was interrupted while writing it. It is cut off, any other
+ * problem with the file is an error. Returns the type and id of the last
+ * object copied or item_type::undefined if nothing was copied.
+ */
+static std::pair<osmium::item_type, osmium::object_id_type>
+copy_partial_output(std::string const &filename, osmium::io::Writer *writer,
+                    osmium::VerboseOutput *vout)
+{
+    std::pair<osmium::item_type, osmium::object_id_type> last{
+        osmium::item_type::undefined, 0};
+
+    std::size_t const size = complete_pbf_size(filename);
+    if (size < osmium::file_size(filename)) {
+        *vout << "Ignoring incomplete last block of partial output.\n";
+        if (::truncate(filename.c_str(), static_cast<off_t>(size)) != 0) {
+            throw std::system_error{errno, std::system_category(),
+                                    "Can not truncate '" + filename + "'"};
+        }
+    }
+    if (size == 0) {
+        return last;
+    }
+
+    osmium::io::Reader reader{filename};
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (auto it = buffer.begin<osmium::OSMObject>();
+             it != buffer.end<osmium::OSMObject>(); ++it) {
+            last = std::make_pair(it->type(), it->id());
+        }
+        (*writer)(std::move(buffer));
+    }
+    reader.close();
+
+    return last;
+}
+
 int main(int argc, char *argv[])
 {
-    char const *const short_options = "c:f:g:hi:Io:Ou:vV";
+    char const *const short_options = "c:C:f:g:hi:Ij:L:m:o:OpP:Rr:t:u:vV";
 
-    std::array<option, 12> const long_options = {
+    std::array<option, 21> const long_options = {
         {{"config-file", required_argument, nullptr, 'c'},
+         {"changes", required_argument, nullptr, 'C'},
          {"output-format", required_argument, nullptr, 'f'},
          {"geom-proc", required_argument, nullptr, 'g'},
          {"help", no_argument, nullptr, 'h'},
          {"index-type", required_argument, nullptr, 'i'},
          {"show-index-types", no_argument, nullptr, 'I'},
+         {"threads", required_argument, nullptr, 'j'},
+         {"lua-cache", required_argument, nullptr, 'L'},
+         {"memory-limit", required_argument, nullptr, 'm'},
          {"output", required_argument, nullptr, 'o'},
          {"overwrite", no_argument, nullptr, 'O'},
+         {"progress", no_argument, nullptr, 'p'},
+         {"progress-file", required_argument, nullptr, 'P'},
+         {"resume", no_argument, nullptr, 'R'},
+         {"keep-referenced", required_argument, nullptr, 'r'},
+         {"trace-slow", required_argument, nullptr, 't'},
          {"untagged", required_argument, nullptr, 'u'},
          {"verbose", no_argument, nullptr, 'v'},
          {"version", no_argument, nullptr, 'V'},
@@ -128,11 +331,21 @@ int main(int argc, char *argv[])
     std::string input_filename;
     std::string output_filename;
     std::string output_format;
+    std::string changes_filename;
+    std::string progress_filename;
+    std::string lua_cache_dir;
     std::string index_name{"flex_mem"};
+    bool index_name_set = false;
+    std::size_t memory_limit = 0;
+    std::size_t trace_slow = 0;
+    std::size_t num_threads = 1;
     geom_proc_type geom_proc = geom_proc_type::none;
     osmium::io::overwrite overwrite = osmium::io::overwrite::no;
     auto untagged = untagged_mode::copy;
+    auto keep_referenced = keep_referenced_mode::none;
 
+    bool resume = false;
+    bool show_progress = false;
     bool verbose = false;
 
     try {
@@ -144,6 +357,9 @@ int main(int argc, char *argv[])
             case 'c':
                 config_filename = optarg;
                 break;
+            case 'C':
+                changes_filename = optarg;
+                break;
             case 'f':
                 output_format = optarg;
                 break;
@@ -155,16 +371,41 @@ int main(int argc, char *argv[])
                 return 0;
             case 'i':
                 index_name = check_index_type(optarg);
+                index_name_set = true;
                 break;
             case 'I':
                 show_index_types();
                 return 0;
+            case 'j':
+                num_threads = check_threads(optarg);
+                break;
+            case 'L':
+                lua_cache_dir = optarg;
+                break;
+            case 'm':
+                memory_limit = parse_size(optarg);
+                break;
             case 'o':
                 output_filename = optarg;
                 break;
             case 'O':
                 overwrite = osmium::io::overwrite::allow;
                 break;
+            case 'p':
+                show_progress = true;
+                break;
+            case 'P':
+                progress_filename = optarg;
+                break;
+            case 'R':
+                resume = true;
+                break;
+            case 'r':
+                keep_referenced = check_keep_referenced(optarg);
+                break;
+            case 't':
+                trace_slow = check_trace_slow(optarg);
+                break;
             case 'u':
                 untagged = check_untagged(optarg);
                 break;
@@ -180,16 +421,39 @@ int main(int argc, char *argv[])
             }
         }
 
+        if (index_name_set && memory_limit > 0) {
+            std::cerr << "Can not use --index-type and --memory-limit "
+                         "together.\n";
+            return 2;
+        }
+
+        if (memory_limit > 0 && geom_proc == geom_proc_type::none) {
+            std::cerr << "The --memory-limit option only makes sense with "
+                         "--geom-proc=bbox.\n";
+            return 2;
+        }
+
         if (config_filename.empty()) {
             std::cerr << "Missing config file. Try with --help.\n";
             return 2;
         }
 
-        if (output_filename.empty() && output_format.empty()) {
+        if (output_filename.empty() && output_format.empty() &&
+            changes_filename.empty()) {
             std::cerr << "Missing output file or format. Try with --help.\n";
             return 2;
         }
 
+        if (resume && (output_filename.empty() || output_filename == "-")) {
+            std::cerr << "Need output file name (-o) for --resume.\n";
+            return 2;
+        }
+
+        if (resume && !changes_filename.empty()) {
+            std::cerr << "Can not use --resume together with --changes.\n";
+            return 2;
+        }
+
         if (optind >= argc) {
             std::cerr << "Missing input file. Try with --help.\n";
             return 2;
@@ -205,33 +469,344 @@ int main(int argc, char *argv[])
     try {
         osmium::VerboseOutput vout{verbose};
         vout << "osm-tags-transform " << PROJECT_VERSION << " started\n";
+        index_selection indexes;
         if (geom_proc == geom_proc_type::none) {
             vout << "No geometry processing. bbox will not be available\n";
         } else {
             vout << "Geometry processing enabled. bbox will be available\n";
-            vout << "Using index type '" << index_name << "'\n";
+            if (memory_limit > 0) {
+                osmium::io::File const input_file{input_filename};
+                osmium::io::Reader header_reader{
+                    input_file, osmium::osm_entity_bits::nothing};
+                auto const bbox = header_reader.header().box();
+                auto const file_size = header_reader.file_size();
+                header_reader.close();
+
+                char const *const tmp_dir = std::getenv("TMPDIR");
+                indexes = select_indexes(memory_limit, input_file, file_size,
+                                         bbox, tmp_dir ? tmp_dir : "/tmp",
+                                         &vout);
+            } else {
+                indexes.node_index = index_name;
+            }
+            vout << "Using index type '" << indexes.node_index << "'\n";
+        }
+
+        std::unique_ptr<LocationIndexes> location_indexes;
+        if (geom_proc != geom_proc_type::none) {
+            try {
+                location_indexes = std::make_unique<LocationIndexes>(
+                    indexes.node_index, indexes.way_index);
+            } catch (...) {
+                remove_files(indexes.tmp_files);
+                throw;
+            }
+            // The index files are open now, they will be removed when the
+            // program ends.
+            remove_files(indexes.tmp_files);
+        }
+
+        // Each thread needs its own handler with its own Lua state.
+        auto const lua_start = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<Handler>> handlers;
+        for (std::size_t i = 0; i < num_threads; ++i) {
+            handlers.push_back(std::make_unique<Handler>(
+                config_filename, location_indexes.get(), untagged,
+                lua_cache_dir));
+        }
+        Handler &handler = *handlers.front();
+
+        // The other handlers load the same code, so only the numbers from
+        // the first one are interesting.
+        LuaCache const &lua_cache = handler.lua_cache();
+
+        auto const lua_time =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - lua_start);
+        vout << "Lua setup took " << lua_time.count() << "ms";
+        if (lua_cache.enabled()) {
+            vout << " (Lua cache in '" << lua_cache_dir
+                 << "': " << lua_cache.hits() << " hits, "
+                 << lua_cache.misses() << " misses)";
+        }
+        vout << '\n';
+        if (num_threads > 1) {
+            vout << "Using " << num_threads << " threads\n";
+        }
+
+        ReferencedIds referenced_ids;
+        if (keep_referenced != keep_referenced_mode::none) {
+            vout << "Collecting ids of referenced objects from '"
+                 << input_filename << "'...\n";
+            referenced_ids.collect(input_filename, &handler,
+                                   location_indexes.get());
+            vout << "Memory used for referenced ids: "
+                 << (referenced_ids.used_memory() / (1024UL * 1024UL))
+                 << "MBytes\n";
+            for (auto &h : handlers) {
+                h->keep_referenced(&referenced_ids, keep_referenced);
+            }
+        }
+
+        // Set up after collecting the referenced ids, the Lua functions
+        // called there should not show up twice.
+        std::vector<SlowObjects> slow_objects(num_threads,
+                                              SlowObjects{trace_slow});
+        if (trace_slow > 0) {
+            for (std::size_t i = 0; i < num_threads; ++i) {
+                handlers[i]->trace_slow_objects(&slow_objects[i]);
+            }
+        }
+
+        bool const full_output =
+            !output_filename.empty() || !output_format.empty();
+
+        // When resuming, the output of the earlier run is moved out of
+        // the way and copied into the new output file. If there already
+        // is such a file, an earlier resume was interrupted while copying
+        // and the output file is incomplete.
+        std::string const partial_filename{output_filename + ".partial"};
+        if (resume) {
+            osmium::io::File const output_file{output_filename, output_format};
+            if (output_file.format() != osmium::io::file_format::pbf) {
+                throw std::runtime_error{
+                    "The --resume option only works with PBF output."};
+            }
+            if (access(partial_filename.c_str(), F_OK) != 0 &&
+                access(output_filename.c_str(), F_OK) == 0 &&
+                std::rename(output_filename.c_str(),
+                            partial_filename.c_str()) != 0) {
+                throw std::system_error{errno, std::system_category(),
+                                        "Can not resume from '" +
+                                            output_filename + "'"};
+            }
+            overwrite = osmium::io::overwrite::allow;
+        }
+
+        // All objects are needed for the changes, dropped ones included.
+        auto const entities = changes_filename.empty()
+                                  ? handler.needed_entities()
+                                  : osmium::osm_entity_bits::nwr;
+        vout << "Reading object types:"
+             << ((entities & osmium::osm_entity_bits::node) ? " nodes" : "")
+             << ((entities & osmium::osm_entity_bits::way) ? " ways" : "")
+             << ((entities & osmium::osm_entity_bits::relation) ? " relations"
+                                                                 : "")
+             << '\n';
+
+        osmium::io::Reader reader{input_filename, entities};
+
+        std::unique_ptr<osmium::io::Writer> writer;
+        if (full_output) {
+            vout << "Writing into '" << output_filename << "'.\n";
+            writer = std::make_unique<osmium::io::Writer>(
+                osmium::io::File{output_filename, output_format},
+                reader.header(), overwrite);
+        }
+
+        std::unique_ptr<ChangeWriter> changes_writer;
+        if (!changes_filename.empty()) {
+            osmium::io::File changes_file{changes_filename};
+            if (!changes_file.is_true("xml_change_format")) {
+                throw std::runtime_error{
+                    "File name for --changes must end in '.osc' (optionally "
+                    "with '.gz' or '.bz2' suffix)."};
+            }
+            vout << "Writing changes into '" << changes_filename << "'.\n";
+            changes_writer =
+                std::make_unique<ChangeWriter>(changes_file, overwrite);
         }
 
-        Handler handler{config_filename, index_name, geom_proc, untagged};
+        if (resume) {
+            vout << "Copying output of earlier run from '" << partial_filename
+                 << "'...\n";
+            auto const last =
+                copy_partial_output(partial_filename, writer.get(), &vout);
+            if (last.first != osmium::item_type::undefined) {
+                vout << "Resuming after "
+                     << osmium::item_type_to_name(last.first) << ' '
+                     << last.second << ".\n";
+                for (auto &h : handlers) {
+                    h->resume_after(last.first, last.second);
+                }
+            }
+        }
+
+        constexpr std::size_t const changes_buffer_size = 1024UL * 1024UL;
+
+        Progress progress{reader.file_size(), show_progress,
+                          progress_filename};
 
-        vout << "Writing into '" << output_filename << "'.\n";
-        osmium::io::File output_file{output_filename, output_format};
-        osmium::io::Reader reader{input_filename};
-        osmium::io::Writer writer{output_file, reader.header(), overwrite};
+        OutputBuffers output_buffers;
+
+        auto const new_work_item = [&](osmium::memory::Buffer &&buffer) {
+            work_item item;
+            item.output = output_buffers.create(buffer.committed());
+            item.output_capacity = item.output.capacity();
+            if (changes_writer) {
+                item.changes = osmium::memory::Buffer{
+                    changes_buffer_size, osmium::memory::Buffer::auto_grow::yes};
+            }
+            item.offset = reader.offset();
+            item.input = std::move(buffer);
+            return item;
+        };
+
+        auto const write_results = [&](work_item *item) {
+            output_buffers.done(item->output, item->output_capacity,
+                                item->input.committed());
+
+            if (progress.enabled()) {
+                progress.update(item->input, item->offset);
+            }
+
+            if (writer) {
+                (*writer)(std::move(item->output));
+            }
+            if (changes_writer && item->changes.committed() > 0) {
+                changes_writer->write(std::move(item->changes));
+            }
+        };
+
+        // Objects already in the output are found by comparing them with
+        // the last object copied. With geometry processing in several
+        // threads, the nodes must be in the index before the ways and the
+        // ways before the relations. Both only work on sorted input.
+        bool const check_sorted =
+            resume || (num_threads > 1 && location_indexes);
+        SortedCheck sorted_check{resume ? "--resume"
+                                        : "--threads with geometry processing"};
 
         vout << "Start processing '" << input_filename << "'...\n";
-        while (osmium::memory::Buffer buffer = reader.read()) {
-            osmium::memory::Buffer out_buffer{
-                buffer.committed(), osmium::memory::Buffer::auto_grow::yes};
-            handler.set_buffer(&out_buffer);
-            osmium::apply(buffer, handler);
-            writer(std::move(out_buffer));
+        if (num_threads == 1) {
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                if (check_sorted) {
+                    sorted_check.check(buffer);
+                }
+                auto item = new_work_item(std::move(buffer));
+                handler.set_input_buffer(&item.input);
+                handler.set_buffer(&item.output);
+                if (changes_writer) {
+                    handler.set_changes_buffer(&item.changes);
+                }
+                osmium::apply(item.input, handler);
+                write_results(&item);
+            }
+        } else {
+            // The location indexes are filled in phases: Node locations
+            // are added here before the buffer is handed to the workers,
+            // they are only read by workers processing ways and relations.
+            // The way bounding boxes are calculated by the workers and
+            // added to the index here when their results are written.
+            // Before the first relation all workers must have finished,
+            // so that the way index is complete.
+            WorkerPool pool{handlers};
+            std::deque<std::future<work_item>> pending;
+            std::size_t const max_pending = num_threads * 2;
+            bool relations_started = false;
+
+            // Once relations have started, the only way boxes returned are
+            // those of the buffer with the first relation, they have been
+            // added to the index already.
+            auto const finish_oldest = [&]() {
+                auto item = pending.front().get();
+                pending.pop_front();
+                if (location_indexes && !relations_started) {
+                    for (auto const &way_box : item.way_boxes) {
+                        location_indexes->add_way(way_box.first,
+                                                  way_box.second);
+                    }
+                }
+                write_results(&item);
+            };
+
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                if (check_sorted) {
+                    sorted_check.check(buffer);
+                }
+                if (location_indexes) {
+                    bool has_ways = false;
+                    bool has_relations = false;
+                    for (auto const &object :
+                         buffer.select<osmium::OSMObject>()) {
+                        if (object.type() == osmium::item_type::node) {
+                            location_indexes->add_node(
+                                static_cast<osmium::Node const &>(object));
+                        } else if (object.type() == osmium::item_type::way) {
+                            has_ways = true;
+                        } else if (object.type() ==
+                                   osmium::item_type::relation) {
+                            has_relations = true;
+                        }
+                    }
+                    if (has_ways || has_relations) {
+                        location_indexes->prepare_ways();
+                    }
+                    if (has_relations && !relations_started) {
+                        while (!pending.empty()) {
+                            finish_oldest();
+                        }
+                        // Ways in the same buffer as the first relation
+                        // must be in the index before that relation.
+                        if (has_ways) {
+                            location_indexes->add_ways(buffer);
+                        }
+                        location_indexes->prepare_relations();
+                        relations_started = true;
+                    }
+                }
+
+                if (pending.size() >= max_pending) {
+                    finish_oldest();
+                }
+                pending.push_back(pool.submit(new_work_item(std::move(buffer))));
+            }
+
+            while (!pending.empty()) {
+                finish_oldest();
+            }
         }
         reader.close();
-        writer.close();
+        if (progress.enabled()) {
+            progress.done();
+        }
+        if (writer) {
+            writer->close();
+        }
+        if (changes_writer) {
+            changes_writer->close();
+        }
         vout << "Done processing.\n";
 
-        handler.output_memory_used(&vout);
+        if (resume) {
+            std::remove(partial_filename.c_str());
+        }
+
+        if (location_indexes) {
+            location_indexes->output_memory_used(&vout);
+        }
+        output_buffers.output_stats(&vout);
+
+        uint64_t string_cache_hits = 0;
+        uint64_t string_cache_misses = 0;
+        for (auto const &h : handlers) {
+            string_cache_hits += h->string_cache().hits();
+            string_cache_misses += h->string_cache().misses();
+        }
+        if (string_cache_hits + string_cache_misses > 0) {
+            vout << "Lua string cache: " << string_cache_hits << " hits, "
+                 << string_cache_misses << " misses ("
+                 << (string_cache_hits * 100 /
+                     (string_cache_hits + string_cache_misses))
+                 << "% hit rate)\n";
+        }
+
+        if (trace_slow > 0) {
+            for (std::size_t i = 1; i < num_threads; ++i) {
+                slow_objects.front().merge(slow_objects[i]);
+            }
+            slow_objects.front().output(std::cerr);
+        }
 
         osmium::MemoryUsage mem;
         if (mem.peak() != 0) {
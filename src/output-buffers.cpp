@@ -0,0 +1,70 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "output-buffers.hpp"
+
+#include <osmium/memory/item.hpp>
+
+#include <algorithm>
+
+// Buffers are never created smaller than this.
+static constexpr std::size_t const min_buffer_size = 64UL * 1024UL;
+
+// Headroom added to the estimated size. Allocating a bit too much is cheap,
+// because the memory is not touched, growing the buffer means copying.
+static constexpr double const headroom = 1.25;
+
+// Weight of the latest buffer in the moving average of the size ratio.
+static constexpr double const ratio_weight = 0.125;
+
+osmium::memory::Buffer OutputBuffers::create(std::size_t input_size)
+{
+    auto const estimate = static_cast<std::size_t>(
+        static_cast<double>(input_size) * m_ratio * headroom);
+    auto const capacity =
+        osmium::memory::padded_length(std::max(estimate, min_buffer_size));
+
+    ++m_buffers;
+    m_bytes_allocated += capacity;
+
+    return osmium::memory::Buffer{capacity,
+                                  osmium::memory::Buffer::auto_grow::yes};
+}
+
+void OutputBuffers::done(osmium::memory::Buffer const &buffer,
+                         std::size_t initial_capacity, std::size_t input_size)
+{
+    m_bytes_used += buffer.committed();
+    m_bytes_final += buffer.capacity();
+
+    // How often the buffer was reallocated while growing is not known
+    // here, only that it did grow.
+    if (buffer.capacity() > initial_capacity) {
+        ++m_grown_buffers;
+    }
+
+    if (input_size > 0) {
+        double const ratio = static_cast<double>(buffer.committed()) /
+                             static_cast<double>(input_size);
+        m_ratio = ratio_weight * ratio + (1.0 - ratio_weight) * m_ratio;
+        // Make sure we adapt quickly if the output gets larger.
+        m_ratio = std::max(m_ratio, ratio);
+    }
+}
+
+void OutputBuffers::output_stats(osmium::VerboseOutput *vout) const
+{
+    constexpr auto const mbytes = 1024UL * 1024UL;
+
+    *vout << "Output buffers: " << m_buffers << " created, " << m_grown_buffers
+          << " had to grow\n";
+    *vout << "Output buffer sizes: " << (m_bytes_allocated / mbytes)
+          << "MBytes initially, " << (m_bytes_final / mbytes)
+          << "MBytes at the end, " << (m_bytes_used / mbytes)
+          << "MBytes used\n";
+}
@@ -0,0 +1,54 @@
+#ifndef OUTPUT_BUFFERS_HPP
+#define OUTPUT_BUFFERS_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Creates the output buffers for each input buffer. The capacity of new
+ * buffers is based on the ratio of output to input size seen so far, so
+ * that buffers neither have to grow (which means copying their contents)
+ * nor are much larger than needed. Keeps statistics about the buffers
+ * allocated.
+ */
+class OutputBuffers
+{
+public:
+    /// Create output buffer for an input buffer of the specified size.
+    osmium::memory::Buffer create(std::size_t input_size);
+
+    /**
+     * Must be called after an output buffer returned by create() has been
+     * filled and before it is handed to the writer. The initial_capacity
+     * is the capacity the buffer had when it was created.
+     */
+    void done(osmium::memory::Buffer const &buffer,
+              std::size_t initial_capacity, std::size_t input_size);
+
+    void output_stats(osmium::VerboseOutput *vout) const;
+
+private:
+    // Estimated ratio of output to input size. Start with the assumption
+    // that the output is about as large as the input.
+    double m_ratio = 1.0;
+
+    uint64_t m_buffers = 0;
+    uint64_t m_grown_buffers = 0;
+    uint64_t m_bytes_allocated = 0;
+    uint64_t m_bytes_final = 0;
+    uint64_t m_bytes_used = 0;
+
+}; // class OutputBuffers
+
+#endif // OUTPUT_BUFFERS_HPP
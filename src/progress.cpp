@@ -0,0 +1,184 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "progress.hpp"
+
+#include <osmium/util/memory.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <utility>
+
+// Minimum time between two reports in seconds
+static constexpr double const report_interval = 1.0;
+
+static char const *const type_names[] = {"nodes", "ways", "relations"};
+
+static std::string format_duration(double seconds)
+{
+    auto const s = static_cast<uint64_t>(seconds);
+    std::ostringstream out;
+    out << (s / 3600) << ':' << std::setw(2) << std::setfill('0')
+        << ((s / 60) % 60) << ':' << std::setw(2) << std::setfill('0')
+        << (s % 60);
+    return out.str();
+}
+
+Progress::Progress(std::size_t file_size, bool show, std::string filename)
+: m_start(clock::now()), m_last_report(m_start),
+  m_filename(std::move(filename)), m_file_size(file_size), m_show(show)
+{}
+
+void Progress::update(osmium::memory::Buffer const &buffer,
+                      std::size_t offset)
+{
+    for (auto it = buffer.cbegin<osmium::OSMObject>();
+         it != buffer.cend<osmium::OSMObject>(); ++it) {
+        auto const n = osmium::item_type_to_nwr_index(it->type());
+        ++m_count[n];
+        m_current_type = it->type();
+        m_current_id = it->id();
+    }
+    m_offset = offset;
+
+    if (std::chrono::duration<double>(clock::now() - m_last_report)
+            .count() >= report_interval) {
+        report(false);
+    }
+}
+
+void Progress::done()
+{
+    m_offset = m_file_size;
+    report(true);
+}
+
+void Progress::report(bool done)
+{
+    auto const now = clock::now();
+    double const elapsed =
+        std::chrono::duration<double>(now - m_start).count();
+
+    // The rates are those since the last report, when done they are the
+    // averages over the whole run.
+    double const interval =
+        done ? elapsed
+             : std::chrono::duration<double>(now - m_last_report).count();
+    for (std::size_t n = 0; n < m_count.size(); ++n) {
+        auto const count = done ? m_count[n] : m_count[n] - m_last_count[n];
+        m_rate[n] =
+            interval > 0.0 ? static_cast<double>(count) / interval : 0.0;
+    }
+    m_last_count = m_count;
+    m_last_report = now;
+
+    // Estimated time remaining, negative if unknown.
+    double eta = -1.0;
+    if (done) {
+        eta = 0.0;
+    } else if (m_file_size > 0 && m_offset > 0) {
+        double const fraction = static_cast<double>(m_offset) /
+                                static_cast<double>(m_file_size);
+        eta = elapsed * (1.0 - fraction) / fraction;
+    }
+
+    if (m_show) {
+        show(elapsed, eta, done);
+    }
+    if (!m_filename.empty()) {
+        write_file(elapsed, eta, done);
+    }
+}
+
+void Progress::show(double elapsed, double eta, bool done) const
+{
+    std::ostringstream out;
+
+    out << '\r' << '[' << format_duration(elapsed) << ']';
+    if (m_file_size > 0) {
+        out << ' ' << std::fixed << std::setprecision(1)
+            << (100.0 * static_cast<double>(m_offset) /
+                static_cast<double>(m_file_size))
+            << '%';
+    }
+    for (std::size_t n = 0; n < m_count.size(); ++n) {
+        out << ' ' << type_names[n] << ": " << m_count[n];
+        if (elapsed > 0.0) {
+            out << " (" << std::fixed << std::setprecision(0) << m_rate[n]
+                << "/s)";
+        }
+    }
+    if (m_current_type != osmium::item_type::undefined) {
+        out << " at " << osmium::item_type_to_char(m_current_type)
+            << m_current_id;
+    }
+    if (eta >= 0.0) {
+        out << " ETA " << format_duration(eta);
+    }
+    out << (done ? "\n" : "   ");
+
+    std::cerr << out.str() << std::flush;
+}
+
+/**
+ * Write progress as JSON object into a temporary file and then rename it,
+ * so that readers always see a complete file. Problems with the file are
+ * not worth stopping the processing for, so a warning is printed and no
+ * progress is written from then on.
+ */
+void Progress::write_file(double elapsed, double eta, bool done)
+{
+    std::string const tmp_filename{m_filename + ".tmp"};
+
+    {
+        std::ofstream out{tmp_filename};
+        if (!out) {
+            std::cerr << "Warning: Can not open progress file '"
+                      << tmp_filename << "': " << std::strerror(errno)
+                      << ". Not writing progress file any more.\n";
+            m_filename.clear();
+            return;
+        }
+
+        out << std::fixed << std::setprecision(3);
+        out << "{\n";
+        out << "  \"done\": " << (done ? "true" : "false") << ",\n";
+        out << "  \"elapsed_seconds\": " << elapsed << ",\n";
+        out << "  \"bytes_read\": " << m_offset << ",\n";
+        out << "  \"bytes_total\": " << m_file_size << ",\n";
+        if (eta >= 0.0) {
+            out << "  \"eta_seconds\": " << eta << ",\n";
+        }
+        for (std::size_t n = 0; n < m_count.size(); ++n) {
+            out << "  \"" << type_names[n] << "\": " << m_count[n] << ",\n";
+            out << "  \"" << type_names[n] << "_per_second\": " << m_rate[n]
+                << ",\n";
+        }
+        if (m_current_type != osmium::item_type::undefined) {
+            out << "  \"current_type\": \""
+                << osmium::item_type_to_name(m_current_type) << "\",\n";
+            out << "  \"current_id\": " << m_current_id << ",\n";
+        }
+        osmium::MemoryUsage mem;
+        out << "  \"peak_memory_mb\": " << mem.peak() << "\n";
+        out << "}\n";
+    }
+
+    if (std::rename(tmp_filename.c_str(), m_filename.c_str()) != 0) {
+        std::cerr << "Warning: Can not rename progress file to '"
+                  << m_filename << "': " << std::strerror(errno)
+                  << ". Not writing progress file any more.\n";
+        std::remove(tmp_filename.c_str());
+        m_filename.clear();
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Reports progress while processing the input file. It is updated after
+ * each buffer and shows the number of objects processed, their rate,
+ * and an estimate of the remaining time on stderr. The same information
+ * can be written to a file in JSON format so that it can be polled by
+ * other programs.
+ */
+class Progress
+{
+public:
+    /**
+     * \param file_size Size of the input file, 0 if unknown.
+     * \param show Show progress on stderr.
+     * \param filename Write progress to this file (if not empty).
+     */
+    Progress(std::size_t file_size, bool show, std::string filename);
+
+    /// Is progress reporting enabled at all?
+    bool enabled() const noexcept { return m_show || !m_filename.empty(); }
+
+    /**
+     * Update counters with the objects in this buffer. The offset is the
+     * number of bytes read from the input file so far.
+     */
+    void update(osmium::memory::Buffer const &buffer, std::size_t offset);
+
+    /// Report final numbers.
+    void done();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    void report(bool done);
+    void show(double elapsed, double eta, bool done) const;
+    void write_file(double elapsed, double eta, bool done);
+
+    std::array<uint64_t, 3> m_count{};
+    std::array<uint64_t, 3> m_last_count{};
+    std::array<double, 3> m_rate{};
+    clock::time_point m_start;
+    clock::time_point m_last_report;
+    std::string m_filename;
+    std::size_t m_file_size;
+    std::size_t m_offset = 0;
+    osmium::item_type m_current_type = osmium::item_type::undefined;
+    osmium::object_id_type m_current_id = 0;
+    bool m_show;
+
+}; // class Progress
+
+#endif // PROGRESS_HPP
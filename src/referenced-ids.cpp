@@ -0,0 +1,209 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "referenced-ids.hpp"
+
+#include "handler.hpp"
+#include "location-indexes.hpp"
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+
+#include <cstdint>
+#include <vector>
+
+void ReferencedIds::collect(std::string const &filename, Handler *handler,
+                            LocationIndexes *indexes)
+{
+    // Relations dropped by the Lua code. If they are referenced from
+    // relations in the output, they are kept, and their members are
+    // referenced, too. Only the ids are needed, so they are stored
+    // compactly instead of keeping the complete relations: The members of
+    // relation n are in members from ends[n - 1] up to ends[n], each
+    // stored as the id shifted left by two bits with the type in the
+    // lowest bits.
+    struct
+    {
+        std::vector<osmium::unsigned_object_id_type> ids;
+        std::vector<std::size_t> ends;
+        std::vector<uint64_t> members;
+    } dropped_relations;
+
+    // First pass: Find out which ways and relations survive and collect
+    // their references.
+    auto entities =
+        osmium::osm_entity_bits::way | osmium::osm_entity_bits::relation;
+    if (indexes) {
+        entities |= osmium::osm_entity_bits::node;
+    }
+
+    osmium::io::Reader reader{filename, entities};
+    way_box_batch batch;
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        bool way_boxes_calculated = false;
+        auto way_box = batch.boxes.cbegin();
+        for (auto const &object : buffer.select<osmium::OSMObject>()) {
+            osmium::Box box;
+            switch (object.type()) {
+            case osmium::item_type::node:
+                indexes->add_node(static_cast<osmium::Node const &>(object));
+                break;
+            case osmium::item_type::way: {
+                auto const &way = static_cast<osmium::Way const &>(object);
+                if (indexes) {
+                    if (!way_boxes_calculated) {
+                        indexes->prepare_ways();
+                        indexes->calculate_way_boxes(buffer, &batch);
+                        way_box = batch.boxes.cbegin();
+                        way_boxes_calculated = true;
+                    }
+                    box = *way_box++;
+                    if (box.valid()) {
+                        indexes->add_way(way.positive_id(), box);
+                    }
+                }
+                if (handler->survives(way, box)) {
+                    m_surviving_ways.set(way.positive_id());
+                    add_nodes(way);
+                }
+                break;
+            }
+            case osmium::item_type::relation: {
+                auto const &relation =
+                    static_cast<osmium::Relation const &>(object);
+                if (indexes) {
+                    indexes->prepare_relations();
+                    box = indexes->relation_box(relation);
+                }
+                if (handler->survives(relation, box)) {
+                    m_surviving_relations.set(relation.positive_id());
+                    add_members(relation);
+                } else {
+                    dropped_relations.ids.push_back(relation.positive_id());
+                    for (auto const &member : relation.members()) {
+                        dropped_relations.members.push_back(
+                            (member.positive_ref() << 2U) |
+                            static_cast<uint64_t>(member.type()));
+                    }
+                    dropped_relations.ends.push_back(
+                        dropped_relations.members.size());
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+    reader.close();
+
+    if (indexes) {
+        indexes->set_complete();
+    }
+
+    // Dropped relations referenced from relations in the output are kept,
+    // so their members are referenced. Repeat until nothing changes,
+    // because they can be members of each other in any order.
+    id_set_type kept_relations;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        std::size_t begin = 0;
+        for (std::size_t n = 0; n < dropped_relations.ids.size(); ++n) {
+            auto const id = dropped_relations.ids[n];
+            auto const end = dropped_relations.ends[n];
+            if (m_relations.get(id) && !kept_relations.get(id)) {
+                kept_relations.set(id);
+                for (auto i = begin; i < end; ++i) {
+                    auto const member = dropped_relations.members[i];
+                    add_member(static_cast<osmium::item_type>(member & 3U),
+                               member >> 2U);
+                }
+                changed = true;
+            }
+            begin = end;
+        }
+    }
+
+    // Second pass: Dropped ways referenced from relations in the output
+    // are kept, so their nodes are referenced.
+    if (!m_ways.empty()) {
+        osmium::io::Reader way_reader{filename, osmium::osm_entity_bits::way};
+        while (osmium::memory::Buffer buffer = way_reader.read()) {
+            for (auto const &way : buffer.select<osmium::Way>()) {
+                if (m_ways.get(way.positive_id())) {
+                    add_nodes(way);
+                }
+            }
+        }
+        way_reader.close();
+    }
+}
+
+void ReferencedIds::add_nodes(osmium::Way const &way)
+{
+    for (auto const &nr : way.nodes()) {
+        m_nodes.set(nr.positive_ref());
+    }
+}
+
+void ReferencedIds::add_member(osmium::item_type type,
+                               osmium::unsigned_object_id_type id)
+{
+    switch (type) {
+    case osmium::item_type::node:
+        m_nodes.set(id);
+        break;
+    case osmium::item_type::way:
+        m_ways.set(id);
+        break;
+    case osmium::item_type::relation:
+        m_relations.set(id);
+        break;
+    default:
+        break;
+    }
+}
+
+void ReferencedIds::add_members(osmium::Relation const &relation)
+{
+    for (auto const &member : relation.members()) {
+        add_member(member.type(), member.positive_ref());
+    }
+}
+
+bool ReferencedIds::contains(osmium::OSMObject const &object) const noexcept
+{
+    switch (object.type()) {
+    case osmium::item_type::node:
+        return m_nodes.get(object.positive_id());
+    case osmium::item_type::way:
+        return m_ways.get(object.positive_id());
+    case osmium::item_type::relation:
+        return m_relations.get(object.positive_id());
+    default:
+        break;
+    }
+    return false;
+}
+
+bool ReferencedIds::survived(osmium::OSMObject const &object) const noexcept
+{
+    if (object.type() == osmium::item_type::way) {
+        return m_surviving_ways.get(object.positive_id());
+    }
+    return m_surviving_relations.get(object.positive_id());
+}
+
+std::size_t ReferencedIds::used_memory() const noexcept
+{
+    return m_nodes.used_memory() + m_ways.used_memory() +
+           m_relations.used_memory() + m_surviving_ways.used_memory() +
+           m_surviving_relations.used_memory();
+}
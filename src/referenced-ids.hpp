@@ -0,0 +1,78 @@
+#ifndef REFERENCED_IDS_HPP
+#define REFERENCED_IDS_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include <osmium/index/id_set.hpp>
+#include <osmium/osm.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class Handler;
+class LocationIndexes;
+
+/**
+ * The ids of all nodes, ways, and relations referenced from ways and
+ * relations which are in the output. This is used so that referenced
+ * objects can be kept in the output even if they would be dropped
+ * otherwise.
+ *
+ * It also remembers which ways and relations survived the Lua processing,
+ * so that the decision is not made again (possibly differently) later.
+ */
+class ReferencedIds
+{
+public:
+    /**
+     * Collect the referenced ids from the input file. The Lua functions
+     * of the handler are called for all ways and relations to find out
+     * which of them are dropped. Objects referenced only from dropped
+     * objects are not collected, unless those objects are kept themselves
+     * because they are referenced.
+     *
+     * If indexes is not nullptr, the location indexes are filled on the
+     * way, so that the objects have their bounding boxes. The indexes
+     * are complete afterwards.
+     */
+    void collect(std::string const &filename, Handler *handler,
+                 LocationIndexes *indexes);
+
+    /// Is this object referenced from any way or relation in the output?
+    bool contains(osmium::OSMObject const &object) const noexcept;
+
+    /**
+     * Did this way or relation survive the Lua processing when the ids
+     * were collected? If not, it is dropped (unless it is referenced)
+     * without calling the Lua function again.
+     */
+    bool survived(osmium::OSMObject const &object) const noexcept;
+
+    std::size_t used_memory() const noexcept;
+
+private:
+    using id_set_type =
+        osmium::index::IdSetDense<osmium::unsigned_object_id_type>;
+
+    void add_member(osmium::item_type type,
+                    osmium::unsigned_object_id_type id);
+    void add_nodes(osmium::Way const &way);
+    void add_members(osmium::Relation const &relation);
+
+    id_set_type m_nodes;
+    id_set_type m_ways;
+    id_set_type m_relations;
+
+    id_set_type m_surviving_ways;
+    id_set_type m_surviving_relations;
+
+}; // class ReferencedIds
+
+#endif // REFERENCED_IDS_HPP
@@ -0,0 +1,80 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "slow-objects.hpp"
+
+#include <algorithm>
+
+/// Number of way nodes or relation members of the object.
+static std::size_t num_members(osmium::OSMObject const &object) noexcept
+{
+    if (object.type() == osmium::item_type::way) {
+        return static_cast<osmium::Way const &>(object).nodes().size();
+    }
+    if (object.type() == osmium::item_type::relation) {
+        return static_cast<osmium::Relation const &>(object).members().size();
+    }
+    return 0;
+}
+
+void SlowObjects::add(osmium::OSMObject const &object, duration_type duration)
+{
+    if (m_objects.size() == m_max_objects &&
+        duration <= m_objects.front().duration) {
+        return;
+    }
+
+    add(entry{duration, object.type(), object.id(), object.tags().size(),
+              num_members(object)});
+}
+
+void SlowObjects::merge(SlowObjects const &other)
+{
+    for (auto const &e : other.m_objects) {
+        add(e);
+    }
+}
+
+void SlowObjects::add(entry const &e)
+{
+    // Ordering the heap by "greater" puts the fastest of the objects
+    // recorded so far at the front.
+    auto const compare = [](entry const &a, entry const &b) {
+        return a.duration > b.duration;
+    };
+
+    if (m_objects.size() == m_max_objects) {
+        if (e.duration <= m_objects.front().duration) {
+            return;
+        }
+        std::pop_heap(m_objects.begin(), m_objects.end(), compare);
+        m_objects.pop_back();
+    }
+
+    m_objects.push_back(e);
+    std::push_heap(m_objects.begin(), m_objects.end(), compare);
+}
+
+void SlowObjects::output(std::ostream &out) const
+{
+    auto objects = m_objects;
+    std::sort(objects.begin(), objects.end(),
+              [](entry const &a, entry const &b) {
+                  return a.duration > b.duration;
+              });
+
+    out << "Slowest objects (type id tags members microseconds):\n";
+    for (auto const &e : objects) {
+        out << "  " << osmium::item_type_to_char(e.type) << e.id << ' '
+            << e.num_tags << ' ' << e.num_members << ' '
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                   e.duration)
+                   .count()
+            << '\n';
+    }
+}
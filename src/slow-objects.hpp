@@ -0,0 +1,63 @@
+#ifndef SLOW_OBJECTS_HPP
+#define SLOW_OBJECTS_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include <osmium/osm.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+/**
+ * Keeps track of the objects for which the Lua processing functions took
+ * the most time. Only the N slowest objects are kept in a min-heap, so
+ * adding an object which is faster than all of them is cheap.
+ */
+class SlowObjects
+{
+public:
+    using duration_type = std::chrono::steady_clock::duration;
+
+    explicit SlowObjects(std::size_t max_objects)
+    : m_max_objects(max_objects)
+    {
+        m_objects.reserve(max_objects);
+    }
+
+    bool enabled() const noexcept { return m_max_objects > 0; }
+
+    /// Record that processing the object took the specified time.
+    void add(osmium::OSMObject const &object, duration_type duration);
+
+    /// Add the objects recorded in other (from another thread).
+    void merge(SlowObjects const &other);
+
+    /// Write list of slowest objects, the slowest first.
+    void output(std::ostream &out) const;
+
+private:
+    struct entry
+    {
+        duration_type duration;
+        osmium::item_type type;
+        osmium::object_id_type id;
+        std::size_t num_tags;
+        std::size_t num_members;
+    }; // struct entry
+
+    void add(entry const &e);
+
+    std::vector<entry> m_objects;
+    std::size_t m_max_objects;
+
+}; // class SlowObjects
+
+#endif // SLOW_OBJECTS_HPP
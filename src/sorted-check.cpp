@@ -0,0 +1,39 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "sorted-check.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <tuple>
+
+static std::tuple<osmium::item_type, bool, osmium::unsigned_object_id_type>
+sort_key(osmium::item_type type, osmium::object_id_type id) noexcept
+{
+    return std::make_tuple(
+        type, id > 0,
+        static_cast<osmium::unsigned_object_id_type>(std::abs(id)));
+}
+
+void SortedCheck::check(osmium::memory::Buffer const &buffer)
+{
+    for (auto const &object : buffer.select<osmium::OSMObject>()) {
+        if (m_last_type != osmium::item_type::undefined &&
+            sort_key(object.type(), object.id()) <=
+                sort_key(m_last_type, m_last_id)) {
+            throw std::runtime_error{
+                std::string{"Input file must be sorted for "} + m_option +
+                " (found " + osmium::item_type_to_name(object.type()) + ' ' +
+                std::to_string(object.id()) + " after " +
+                osmium::item_type_to_name(m_last_type) + ' ' +
+                std::to_string(m_last_id) + ")."};
+        }
+        m_last_type = object.type();
+        m_last_id = object.id();
+    }
+}
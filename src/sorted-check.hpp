@@ -0,0 +1,43 @@
+#ifndef SORTED_CHECK_HPP
+#define SORTED_CHECK_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm.hpp>
+
+#include <string>
+#include <utility>
+
+/**
+ * Checks that the objects in the input are sorted by type and id in the
+ * order usual for OSM files: nodes, then ways, then relations, each
+ * ordered by id with negative ids first. Every object must only be there
+ * once, so history files are not allowed.
+ */
+class SortedCheck
+{
+public:
+    /**
+     * The option is the command line option which needs the sorted
+     * input. It is used in the error message.
+     */
+    explicit SortedCheck(std::string option) : m_option(std::move(option)) {}
+
+    /// Throw if the objects in the buffer are not in order.
+    void check(osmium::memory::Buffer const &buffer);
+
+private:
+    std::string m_option;
+    osmium::item_type m_last_type = osmium::item_type::undefined;
+    osmium::object_id_type m_last_id = 0;
+
+}; // class SortedCheck
+
+#endif // SORTED_CHECK_HPP
@@ -0,0 +1,78 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "worker-pool.hpp"
+
+#include <osmium/visitor.hpp>
+
+#include <exception>
+
+WorkerPool::WorkerPool(std::vector<std::unique_ptr<Handler>> const &handlers)
+{
+    m_threads.reserve(handlers.size());
+    for (auto const &handler : handlers) {
+        m_threads.emplace_back(&WorkerPool::run, this, handler.get());
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> const lock{m_mutex};
+        m_done = true;
+        m_queue.clear();
+    }
+    m_cv.notify_all();
+
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+std::future<work_item> WorkerPool::submit(work_item item)
+{
+    std::promise<work_item> promise;
+    auto future = promise.get_future();
+
+    {
+        std::lock_guard<std::mutex> const lock{m_mutex};
+        m_queue.emplace_back(std::move(item), std::move(promise));
+    }
+    m_cv.notify_one();
+
+    return future;
+}
+
+void WorkerPool::run(Handler *handler)
+{
+    while (true) {
+        std::pair<work_item, std::promise<work_item>> task;
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            m_cv.wait(lock, [this]() { return m_done || !m_queue.empty(); });
+            if (m_done) {
+                return;
+            }
+            task = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        auto &item = task.first;
+        try {
+            handler->set_input_buffer(&item.input);
+            handler->set_buffer(&item.output);
+            handler->set_changes_buffer(item.changes ? &item.changes
+                                                     : nullptr);
+            handler->use_indexes_read_only(&item.way_boxes);
+            osmium::apply(item.input, *handler);
+            task.second.set_value(std::move(item));
+        } catch (...) {
+            task.second.set_exception(std::current_exception());
+        }
+    }
+}
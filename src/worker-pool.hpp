@@ -0,0 +1,87 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+#include "handler.hpp"
+#include "location-indexes.hpp"
+
+#include <osmium/memory/buffer.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * One input buffer to be processed by a worker together with the buffers
+ * the results are written to.
+ */
+struct work_item
+{
+    osmium::memory::Buffer input;
+    osmium::memory::Buffer output;
+
+    /// Capacity of the output buffer when it was created.
+    std::size_t output_capacity = 0;
+
+    /// Invalid (default constructed) buffer if changes are not needed.
+    osmium::memory::Buffer changes;
+
+    /// Bounding boxes of the ways in the input buffer.
+    way_boxes_type way_boxes;
+
+    /// Offset in the input file after reading the input buffer.
+    std::size_t offset = 0;
+}; // struct work_item
+
+/**
+ * Processes input buffers in several threads, each with its own handler.
+ * The handlers only read from the location indexes, see
+ * Handler::use_indexes_read_only().
+ */
+class WorkerPool
+{
+public:
+    /// Start one thread for each of the handlers.
+    explicit WorkerPool(std::vector<std::unique_ptr<Handler>> const &handlers);
+
+    WorkerPool(WorkerPool const &) = delete;
+    WorkerPool &operator=(WorkerPool const &) = delete;
+
+    WorkerPool(WorkerPool &&) = delete;
+    WorkerPool &operator=(WorkerPool &&) = delete;
+
+    /// Stops all threads after they have finished their current work.
+    ~WorkerPool();
+
+    /**
+     * Queue the work item. The returned future becomes ready when it is
+     * processed. Exceptions thrown while processing are rethrown from the
+     * future.
+     */
+    std::future<work_item> submit(work_item item);
+
+private:
+    void run(Handler *handler);
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::pair<work_item, std::promise<work_item>>> m_queue;
+    std::vector<std::thread> m_threads;
+    bool m_done = false;
+
+}; // class WorkerPool
+
+#endif // WORKER_POOL_HPP
@@ -0,0 +1,17 @@
+--
+-- Add the bounding box of each object as a tag
+--
+
+local function add_bbox(object)
+    local b = object.bbox
+    if b then
+        object:set_tag('bbox', string.format('%.2f/%.2f/%.2f/%.2f',
+                                             b[1], b[2], b[3], b[4]))
+    end
+    return true
+end
+
+ott.process_node = add_bbox
+ott.process_way = add_bbox
+ott.process_relation = add_bbox
+
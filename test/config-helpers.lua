@@ -0,0 +1,28 @@
+--
+-- Test the helper functions in the ott namespace
+--
+
+function ott.process_node(object)
+    local keys = ott.keys_with_prefix(object.tags, 'name:')
+    table.sort(keys)
+    object:set_tag('name_keys', table.concat(keys, ';'))
+
+    object:set_tag('matched', table.concat(ott.match_keys(object.tags, 'na*:?n'), ';'))
+
+    object:set_tag('refs', table.concat(ott.split_list(object:get_tag('ref')), '|'))
+
+    if ott.has_prefix(object:get_tag('name'), 'Fo') then
+        object:set_tag('prefix', 'yes')
+    end
+
+    if ott.has_suffix(object:get_tag('name'), 'oo') then
+        object:set_tag('suffix', 'yes')
+    end
+
+    if ott.has_suffix(object:get_tag('name'), 'x') then
+        object:set_tag('wrong_suffix', 'yes')
+    end
+
+    return true
+end
+
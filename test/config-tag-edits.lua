@@ -0,0 +1,28 @@
+--
+-- Test that get_tag() and the tags table see edits made earlier in the
+-- same callback
+--
+
+function ott.process_node(object)
+    object:set_tag('name', 'Bar')
+    object:set_tag('seen_name', object:get_tag('name'))
+
+    object:delete_tag('source')
+    if object:get_tag('source') == nil then
+        object:set_tag('source_deleted', 'yes')
+    end
+
+    object:set_tag('new', 'a')
+    object:set_tag('seen_new', object:get_tag('new'))
+
+    -- tags table created after the edits
+    object:set_tag('seen_in_tags', object.tags.name)
+    object:set_tag('source_in_tags', tostring(object.tags.source))
+
+    -- tags table created before the edit
+    object:set_tag('late', 'b')
+    object:set_tag('seen_late', object.tags.late)
+
+    return true
+end
+
@@ -0,0 +1,152 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm-tags-transform.
+ *
+ * Copyright (C) 2022 by Jochen Topf <jochen@topf.org>.
+ */
+
+/**
+ * Generate an OSM file with synthetic data for the performance tests. It
+ * contains a grid of nodes, ways along the grid rows, and multipolygon
+ * relations made from those ways. Some of the objects have tags typical
+ * for OSM data.
+ */
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+static constexpr int const grid_width = 1000;
+static constexpr int const nodes_per_way = 10;
+static constexpr int const ways_per_relation = 10;
+static constexpr std::size_t const buffer_size = 1024UL * 1024UL;
+
+template <typename TBuilder>
+static void set_attributes(TBuilder *builder, osmium::object_id_type id)
+{
+    builder->set_id(id);
+    builder->set_version(1);
+    builder->set_changeset(1);
+    builder->set_timestamp(osmium::Timestamp{"2022-01-01T00:00:00Z"});
+    builder->set_uid(1);
+    builder->set_user("test");
+}
+
+static void add_name_tags(osmium::builder::TagListBuilder *builder,
+                          osmium::object_id_type id)
+{
+    std::string const name = "Name " + std::to_string(id);
+    builder->add_tag("name", name);
+    builder->add_tag("name:de", name + " (de)");
+    builder->add_tag("name:en", name + " (en)");
+    builder->add_tag("source", "survey");
+}
+
+static void flush(osmium::memory::Buffer *buffer, osmium::io::Writer *writer)
+{
+    if (buffer->committed() > buffer_size - 4096) {
+        (*writer)(std::move(*buffer));
+        *buffer = osmium::memory::Buffer{buffer_size,
+                                         osmium::memory::Buffer::auto_grow::yes};
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        std::cerr << "Usage: generate-input OUTPUT_FILE NUM_NODES\n";
+        return 2;
+    }
+
+    auto const num_nodes = std::atol(argv[2]);
+    auto const num_ways = num_nodes / nodes_per_way;
+    auto const num_relations = num_ways / ways_per_relation;
+
+    try {
+        osmium::io::Header header;
+        header.set("generator", "osm-tags-transform perf test");
+        osmium::io::Writer writer{argv[1], header,
+                                  osmium::io::overwrite::allow};
+        osmium::memory::Buffer buffer{buffer_size,
+                                      osmium::memory::Buffer::auto_grow::yes};
+
+        for (osmium::object_id_type id = 1; id <= num_nodes; ++id) {
+            {
+                osmium::builder::NodeBuilder builder{buffer};
+                set_attributes(&builder, id);
+                builder.set_location(osmium::Location{
+                    static_cast<double>((id - 1) % grid_width) * 0.001,
+                    static_cast<double>((id - 1) / grid_width) * 0.001});
+                if (id % 10 == 0) {
+                    osmium::builder::TagListBuilder tags{builder};
+                    tags.add_tag("amenity", "bench");
+                    add_name_tags(&tags, id);
+                }
+            }
+            buffer.commit();
+            flush(&buffer, &writer);
+        }
+
+        for (osmium::object_id_type id = 1; id <= num_ways; ++id) {
+            {
+                osmium::builder::WayBuilder builder{buffer};
+                set_attributes(&builder, id);
+                {
+                    osmium::builder::WayNodeListBuilder nodes{builder};
+                    auto const first = (id - 1) * nodes_per_way + 1;
+                    for (auto ref = first; ref < first + nodes_per_way; ++ref) {
+                        nodes.add_node_ref(ref);
+                    }
+                }
+                osmium::builder::TagListBuilder tags{builder};
+                if (id % 2 == 0) {
+                    tags.add_tag("highway", "residential");
+                } else {
+                    tags.add_tag("building", "yes");
+                }
+                add_name_tags(&tags, id);
+            }
+            buffer.commit();
+            flush(&buffer, &writer);
+        }
+
+        for (osmium::object_id_type id = 1; id <= num_relations; ++id) {
+            {
+                osmium::builder::RelationBuilder builder{buffer};
+                set_attributes(&builder, id);
+                {
+                    osmium::builder::RelationMemberListBuilder members{
+                        builder};
+                    auto const first = (id - 1) * ways_per_relation + 1;
+                    for (auto ref = first; ref < first + ways_per_relation;
+                         ++ref) {
+                        members.add_member(osmium::item_type::way, ref,
+                                           "outer");
+                    }
+                }
+                osmium::builder::TagListBuilder tags{builder};
+                tags.add_tag("type", "multipolygon");
+                tags.add_tag("landuse", "forest");
+                add_name_tags(&tags, id);
+            }
+            buffer.commit();
+            flush(&buffer, &writer);
+        }
+
+        writer(std::move(buffer));
+        writer.close();
+    } catch (std::exception const &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}